@@ -14,653 +14,3850 @@
 // Includes
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <assert.h>
-
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Number of retired nodes that triggers a reclamation in concurrent mode
+#define AVL_RECLAIM_BATCH 256
+// Fewest values avl_insert_batch gives to each of its threads.
+#define AVL_BATCH_GRAIN 4096
+// Index of the first of the 16 great-great-grandchildren of a frozen image
+// index.
+#define AVL_FROZEN_AHEAD(k) ((k) * 16)
+// Number of searches avl_retrieve_many advances in lockstep.
+#define AVL_GROUP 16
+// Marks the start of a file written by avl_save
+#define AVL_FILE_MAGIC "AVL\001"
+#define AVL_FILE_MAGIC_SIZE 4
+// Size of the stdio buffer used by avl_save
+#define AVL_FILE_BUFFER (1 << 20)
+// Starting size of the buffer avl_save writes each value into
+#define AVL_FILE_RECORD 64
+// Loads a pointer that a concurrent writer may be storing to, along with
+// everything the writer stored before publishing it
+#define AVL_LOAD(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+// Stores a link or value that concurrent readers may be loading, after
+// every store that initializes what it points to
+#define AVL_STORE(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#ifdef AVL_STATS
+// Adds n to an event counter of a tree. Readers may count concurrently.
+#define AVL_COUNT(tree, counter, n) \
+	__atomic_fetch_add(&((avl*) (tree))->counters.counter, (n), \
+			__ATOMIC_RELAXED)
+#else
+#define AVL_COUNT(tree, counter, n) ((void) 0)
+#endif
+// Digest of a node of a AVL that keeps digests
+#define AVL_DIGEST(node) (((avl_digest_node*) (node))->digest)
 // Macro for comparing node heights
 #define MAX_HEIGHT(a,b) ((a) > (b) ? a : b)
 // Macros for data comparison
 #define LESS_THAN_EQUAL(x,y) compare((x), (y)) <= 0
 #define GREATER_THAN_EQUAL(x,y) compare((x), (y)) >= 0
 
+/**
+ * Concurrency state of a shared AVL.
+ */
+struct avl_sync {
+	pthread_mutex_t writer; ///< Serializes writers.
+	atomic_uint version; ///< Odd while a writer is changing the tree.
+	atomic_uint epoch; ///< Reclamation epoch.
+	atomic_int readers[2]; ///< Readers active in even and odd epochs.
+	avl_node **retired; ///< Unlinked nodes readers may still be visiting.
+	int retired_count; ///< Number of retired nodes.
+	int retired_capacity; ///< Capacity of the retired array.
+};
+
+/**
+ * Layout of the nodes of a AVL that keeps digests.
+ */
+typedef struct {
+	avl_node node; ///< The node itself, first so the two share an address.
+	uint64_t digest; ///< Sum of the mixed value hashes of the subtree.
+} avl_digest_node;
+
 // Local Functions
 
 /**
- * Initializes a new AVL node with a copy of value.
+ * Returns the size of the nodes of a tree, which have room for a digest
+ * only if the tree keeps digests.
  * @param tree pointer to a AVL tree
- * @param value pointer to the value to assign to the node
- * @return a pointer to a new AVL node
+ * @return the size of a node
  */
-static avl_node* avl_node_initialize(avl *tree, const data *value) {
-	// Base case: add a new node containing a copy of value.
-	avl_node *node = malloc(sizeof *node);
-	assert(node != NULL);
+static size_t avl_node_size(const avl *tree) {
+	return tree->hash != NULL ? sizeof(avl_digest_node) : sizeof(avl_node);
+}
 
-	node->height = 1;
-	node->left = NULL;
-	node->right = NULL;
-	node->value = tree->copy(value);
+/**
+ * Returns a node of a pool chunk.
+ * @param pool pointer to the pool
+ * @param chunk pointer to a chunk of the pool
+ * @param i index of the node in the chunk
+ * @return a pointer to the node
+ */
+static avl_node* avl_chunk_node(const avl_pool *pool, avl_chunk *chunk,
+		int i) {
+	return (avl_node*) ((unsigned char*) chunk->nodes + i * pool->node_size);
+}
+
+/**
+ * Allocates memory for a node, from the tree pool if it has one.
+ * @param tree pointer to a AVL tree
+ * @return a pointer to uninitialized node memory
+ */
+static avl_node* avl_node_alloc(avl *tree) {
+	avl_pool *pool = tree->pool;
+	avl_node *node = NULL;
+
+	AVL_COUNT(tree, allocations, 1);
+	assert(pool == NULL || pool->node_size == avl_node_size(tree));
+
+	if (pool == NULL) {
+		node = malloc(avl_node_size(tree));
+	} else if (pool->free != NULL) {
+		// Reuse a node released by a remove.
+		node = pool->free;
+		pool->free = node->right;
+	} else {
+		if (pool->chunks == NULL || pool->chunks->used == pool->chunk_size) {
+			// Current chunk is exhausted - start a new one.
+			avl_chunk *chunk = malloc(
+					sizeof *chunk + pool->chunk_size * pool->node_size);
+			assert(chunk != NULL);
+			chunk->used = 0;
+			chunk->next = pool->chunks;
+			pool->chunks = chunk;
+		}
+		node = avl_chunk_node(pool, pool->chunks, pool->chunks->used);
+		pool->chunks->used++;
+	}
+	assert(node != NULL);
 	return node;
 }
 
 /**
- * Helper function to determine the height of node - handles empty node.
- * @param node The node to process.
- * @return The height of the current node.
+ * Releases the memory of a node whose value has been destroyed or handed
+ * back to the caller.
+ * @param tree pointer to a AVL tree
+ * @param node pointer to the node to release
  */
-static int avl_node_height(const avl_node *node) {
-	int height = 0;
+static void avl_node_release(avl *tree, avl_node *node) {
+	avl_pool *pool = tree->pool;
 
-	if (node != NULL) {
-		height = node->height;
+	if (pool == NULL) {
+		free(node);
+	} else {
+		// A NULL value marks the node as free for avl_pool_destroy.
+		node->value = NULL;
+		node->left = NULL;
+		node->right = pool->free;
+		pool->free = node;
 	}
-	return height;
+	return;
 }
 
 /**
- * Updates the height of a node. Its height is the max of the heights of its
- * child nodes, plus 1.
- * @param node The node to process.
+ * Destroys all values still stored in a pool and deallocates its chunks.
+ * Runs in O(chunks) deallocations, and visits the nodes in memory order.
+ * @param tree pointer to a AVL tree
  */
-static void avl_update_height(avl_node *node) {
-	int left_height = avl_node_height(node->left);
-	int right_height = avl_node_height(node->right);
+static void avl_pool_destroy(avl *tree) {
+	avl_chunk *chunk = tree->pool->chunks;
 
-	node->height = MAX_HEIGHT(left_height, right_height) + 1;
+	while (chunk != NULL) {
+		avl_chunk *next = chunk->next;
+
+		for (int i = 0; i < chunk->used; i++) {
+			avl_node *node = avl_chunk_node(tree->pool, chunk, i);
+
+			if (node->value != NULL) {
+				tree->destroy(&node->value);
+				AVL_COUNT(tree, destroys, 1);
+			}
+		}
+		free(chunk);
+		chunk = next;
+	}
+	free(tree->pool);
+	tree->pool = NULL;
+	tree->root = NULL;
 	return;
 }
 
 /**
- * Destroys a node and its children.
- * @param tree Pointer to a AVL.
- * @param node The node to process.
+ * Allocates an empty pool.
+ * @param chunk_size number of nodes allocated at once
+ * @param node_size size of a node
+ * @return a pointer to the pool
  */
-static void avl_destroy_aux(avl *tree, avl_node **node) {
+static avl_pool* avl_pool_initialize(int chunk_size, size_t node_size) {
+	avl_pool *pool = malloc(sizeof *pool);
+	assert(pool != NULL);
+
+	pool->chunk_size = chunk_size;
+	pool->node_size = node_size;
+	pool->refs = 1;
+	pool->chunks = NULL;
+	pool->free = NULL;
+	return pool;
+}
 
-	if (*node != NULL) {
-		avl_destroy_aux(tree, &(*node)->left);
-		avl_destroy_aux(tree, &(*node)->right);
-		tree->destroy(&(*node)->value);
-		(*node)->value = NULL;
-		free(*node);
-		*node = NULL;
+/**
+ * Destroys the values of retired nodes and releases the nodes.
+ * @param tree pointer to a shared AVL tree
+ */
+static void avl_sync_release(avl *tree) {
+	avl_sync *sync = tree->sync;
+
+	for (int i = 0; i < sync->retired_count; i++) {
+		avl_node *node = sync->retired[i];
+
+		if (node->value != NULL) {
+			tree->destroy(&node->value);
+			AVL_COUNT(tree, destroys, 1);
+		}
+		avl_node_release(tree, node);
 	}
+	sync->retired_count = 0;
 	return;
 }
 
 /**
- * Performs a left rotation around node.
- * @param node Pointer to the root of a subtree.
- * @return Pointer to new root of subtree.
+ * Reclaims the retired nodes once every reader that could have reached
+ * them has finished. Readers entering from now on register in the next
+ * epoch and can no longer reach the retired nodes, so only the readers
+ * of the current epoch are waited for. Called with the writer lock held.
+ * @param tree pointer to a shared AVL tree
  */
-static avl_node* avl_rotate_left(avl_node *node) {
-	// Rearrange the nodes.
-	avl_node *temp = node->right;
-	node->right = temp->left;
-	temp->left = node;
-	// Update the heights.
-	avl_update_height(node);
-	avl_update_height(temp);
-	// Return new root.
-	return temp;
+static void avl_sync_reclaim(avl *tree) {
+	avl_sync *sync = tree->sync;
+	unsigned int epoch = atomic_load(&sync->epoch);
+
+	atomic_store(&sync->epoch, epoch + 1);
+
+	while (atomic_load(&sync->readers[epoch & 1]) != 0) {
+		sched_yield();
+	}
+	avl_sync_release(tree);
+	return;
 }
 
 /**
- * Performs a right rotation around node.
- * @param node Pointer to the root of a subtree.
- * @return Pointer to new root of subtree.
+ * Disposes of a node that has been unlinked from the tree, along with its
+ * value. In concurrent mode both are kept until no reader can reach them.
+ * @param tree pointer to a AVL tree
+ * @param node pointer to the unlinked node
  */
-static avl_node* avl_rotate_right(avl_node *node) {
-	// Rearrange the nodes.
-	avl_node *temp = node->left;
-	node->left = temp->right;
-	temp->right = node;
-	// Update the heights.
-	avl_update_height(node);
-	avl_update_height(temp);
-	// Return new root.
-	return temp;
+static void avl_node_discard(avl *tree, avl_node *node) {
+	avl_sync *sync = tree->sync;
+
+	if (sync == NULL) {
+		tree->destroy(&node->value);
+		AVL_COUNT(tree, destroys, 1);
+		avl_node_release(tree, node);
+	} else {
+
+		if (sync->retired_count == sync->retired_capacity) {
+			sync->retired_capacity = sync->retired_capacity * 2
+					+ AVL_RECLAIM_BATCH;
+			sync->retired = realloc(sync->retired,
+					sync->retired_capacity * sizeof *sync->retired);
+			assert(sync->retired != NULL);
+		}
+		sync->retired[sync->retired_count++] = node;
+	}
+	return;
 }
 
 /**
- * Determines whether an AVL node is balanced.
- * @param node The node to process.
- * @return an integer between -2 (right-heavy) and 2 (left-heavy)
+ * Takes the writer lock of a shared tree. Does nothing for other trees.
+ * @param tree pointer to a AVL tree
  */
-static int avl_balance_value(const avl_node *node) {
-	return avl_node_height(node->left) - avl_node_height(node->right);
+static void avl_lock(const avl *tree) {
+
+	if (tree->sync != NULL) {
+		pthread_mutex_lock(&tree->sync->writer);
+	}
+	return;
 }
 
 /**
- * Rebalances a node according to AVL rules.
- * @param node Pointer to the node to rebalance.
+ * Releases the writer lock of a shared tree.
+ * @param tree pointer to a AVL tree
  */
-static void avl_rebalance(avl_node **node) {
-	// Update the node height if any of its children have been changed.
-	avl_update_height(*node);
-	// Get the balance factor of this ancestor node to check whether
-	// this node became unbalanced
-	int balance = avl_balance_value(*node);
-	// If this node is unbalanced, then there are 4 cases
+static void avl_unlock(const avl *tree) {
 
-	if (balance > 1 && avl_balance_value((*node)->left) >= 0) {
-		// Left Left Case - single rotation
-		*node = avl_rotate_right(*node);
-	} else if (balance < -1 && avl_balance_value((*node)->right) <= 0) {
-		// Right Right Case - single rotation
-		*node = avl_rotate_left(*node);
-	} else if (balance > 1 && avl_balance_value((*node)->left) < 0) {
-		// Left Right Case - double rotation
-		(*node)->left = avl_rotate_left((*node)->left);
-		*node = avl_rotate_right(*node);
-	} else if (balance < -1 && avl_balance_value((*node)->right) > 0) {
-		// Right Left Case - double rotation
-		(*node)->right = avl_rotate_right((*node)->right);
-		*node = avl_rotate_left(*node);
+	if (tree->sync != NULL) {
+		pthread_mutex_unlock(&tree->sync->writer);
 	}
 	return;
 }
 
 /**
- * Inserts value into a AVL. Insertion must preserve the AVL definition.
- * Only one of value may be in the tree.
- * @param tree Pointer to a AVL.
- * @param node The node to process.
- * @param value The value to insert.
- * @return 1 if the value is inserted, 0 otherwise.
+ * Takes the writer locks of two trees, always in the same order so that
+ * two threads locking the same pair cannot deadlock.
+ * @param target pointer to a AVL tree
+ * @param source pointer to a AVL tree, may be target
  */
-static int avl_insert_aux(avl *tree, avl_node **node, const data *value) {
-	int inserted = 0;
+static void avl_lock_pair(const avl *target, const avl *source) {
+	int ordered = (uintptr_t) target < (uintptr_t) source;
 
-	if (*node == NULL) {
-		// Base case: add a new node containing the value.
-		*node = avl_node_initialize(tree, value);
-		tree->size += 1;
-		inserted = 1;
-	} else {
-		// Compare the node data against the new value.
-		int comp = tree->compare((*node)->value, value);
+	avl_lock(ordered ? target : source);
 
-		if (comp < 0) {
-			// General case: check the left subtree.
-			inserted = avl_insert_aux(tree, &(*node)->left, value);
-		} else if (comp > 0) {
-			// General case: check the right subtree.
-			inserted = avl_insert_aux(tree, &(*node)->right, value);
-		} else {
-			// Base case: value is already in the AVL.
-			inserted = 0;
-		}
-	}
-	if (inserted) {
-		// Rebalance if any of its children have been changed.
-		avl_rebalance(node);
+	if (source != target) {
+		avl_lock(ordered ? source : target);
 	}
-	return inserted;
+	return;
 }
 
 /**
- * Finds a replacement node for a node to be removed from the tree.
- * (Called only by avl_remove_aux.)
- * @param parent Parent of possible replacement node.
- * @return The node to replace the node that is being removed.
+ * Releases the writer locks taken by avl_lock_pair.
+ * @param target pointer to a AVL tree
+ * @param source pointer to a AVL tree, may be target
  */
-static avl_node* avl_delete_node_left(avl_node **parent) {
-	avl_node *repl = NULL;
-	avl_node *child = (*parent)->right;
+static void avl_unlock_pair(const avl *target, const avl *source) {
 
-	if (child->right == NULL) {
-		// child has largest value in left subtree.
-		repl = child;
-		// Move child's left tree up.
-		(*parent)->right = child->left;
-	} else {
-		repl = avl_delete_node_left(&(*parent)->right);
+	if (source != target) {
+		avl_unlock(source);
 	}
-	// Recursively rebalance all parents as necessary.
-	avl_rebalance(parent);
-	return repl;
+	avl_unlock(target);
+	return;
 }
 
 /**
- * Attempts to find a value matching key in a AVL node. Deletes the node
- * if found.
- * @param tree Pointer to a AVL.
- * @param node The node to process.
- * @param key The key to look for.
- * @param value If key is found, the value being removed.
- * @return 1 if the key is found and the value removed, 0 otherwise.
+ * Starts a change to the tree: takes the writer lock and marks the tree
+ * as changing so optimistic readers know to check their results.
+ * @param tree pointer to a AVL tree
  */
-static data* avl_remove_aux(avl *tree, avl_node **node, const data *key) {
-	avl_node *repl = NULL;
-	data *value = NULL;
+static void avl_write_begin(avl *tree) {
+	avl_sync *sync = tree->sync;
+
+	if (sync != NULL) {
+		pthread_mutex_lock(&sync->writer);
+		// Every AVL_STORE that follows is a release, so a reader whose
+		// acquire loads see any of the changes also sees the odd version
+		// when it checks the version again.
+		atomic_store_explicit(&sync->version,
+				atomic_load_explicit(&sync->version, memory_order_relaxed) + 1,
+				memory_order_relaxed);
+	}
+	return;
+}
 
-	if (*node != NULL) {
-		// Compare the node data against the key.
-		int comp = tree->compare((*node)->value, key);
+/**
+ * Ends a change to the tree started by avl_write_begin, and counts it so
+ * cursors placed before it are known to be stale.
+ * @param tree pointer to a AVL tree
+ */
+static void avl_write_end(avl *tree) {
+	avl_sync *sync = tree->sync;
 
-		if (comp < 0) {
-			// Search the left subtree.
-			value = avl_remove_aux(tree, &((*node)->left), key);
-		} else if (comp > 0) {
-			// Search the right subtree.
-			value = avl_remove_aux(tree, &((*node)->right), key);
-		} else {
-			// Value has been found.
-			value = (*node)->value;
-			tree->size--;
-
-			// Replace this node with another node.
-			if ((*node)->left == NULL && (*node)->right == NULL) {
-				// node has no children.
-				*node = NULL;
-			} else if ((*node)->left == NULL) {
-				// node has no left child.
-				*node = (*node)->right;
-			} else if ((*node)->right == NULL) {
-				// node has no right child.
-				*node = (*node)->left;
-			} else {
-				// Node has two children
-				if ((*node)->left->right == NULL) {
-					// left child is replacement node
-					repl = (*node)->left;
-				} else {
-					// find replacement node in right subtree of left node
-					repl = avl_delete_node_left(&(*node)->left);
-					// Make the left child of the node being replaced the left child
-					// of the replacement node.
-					repl->left = (*node)->left;
-				}
-				// Make the right child of the node being replaced the right child
-				// of the replacement node.
-				repl->right = (*node)->right;
-				// Replace the removed node.
-				*node = repl;
-			}
+	tree->changes++;
+
+	if (sync != NULL) {
+		atomic_store_explicit(&sync->version,
+				atomic_load_explicit(&sync->version, memory_order_relaxed) + 1,
+				memory_order_release);
+
+		if (sync->retired_count >= AVL_RECLAIM_BATCH) {
+			avl_sync_reclaim(tree);
 		}
+		pthread_mutex_unlock(&sync->writer);
 	}
-	if (*node != NULL && value != NULL) {
-		// If the value was found, update the ancestor heights.
-		avl_rebalance(node);
+	return;
+}
+
+/**
+ * Registers a reader in the current epoch, so nodes it may reach are not
+ * reclaimed under it.
+ * @param sync pointer to the tree's concurrency state
+ * @return the slot to pass to avl_read_exit
+ */
+static int avl_read_enter(avl_sync *sync) {
+	unsigned int epoch = 0;
+	int entered = 0;
+
+	while (!entered) {
+		epoch = atomic_load(&sync->epoch);
+		atomic_fetch_add(&sync->readers[epoch & 1], 1);
+		// A writer may have moved to the next epoch in the meantime.
+		entered = atomic_load(&sync->epoch) == epoch;
+
+		if (!entered) {
+			atomic_fetch_sub(&sync->readers[epoch & 1], 1);
+		}
 	}
-	return value;
+	return epoch & 1;
 }
 
 /**
- * Copies the contents of a node to an array location.
- * @param tree Pointer to a tree.
- * @param node Pointer to node.
- * @param values Array of values.
- * @param index Current index in array.
- * @return the updated index.
+ * Unregisters a reader registered by avl_read_enter.
+ * @param sync pointer to the tree's concurrency state
+ * @param slot the value returned by avl_read_enter
  */
-static int avl_inorder_aux(const avl *tree, const avl_node *node, data values[],
-		int index) {
+static void avl_read_exit(avl_sync *sync, int slot) {
+	atomic_fetch_sub(&sync->readers[slot], 1);
+	return;
+}
 
-	if (node != NULL) {
-		index = avl_inorder_aux(tree, node->left, values, index);
-		values[index] = *node->value;
-		index++;
-		index = avl_inorder_aux(tree, node->right, values, index);
+/**
+ * Searches for key while writers may be changing the tree. Must be called
+ * between avl_read_enter and avl_read_exit. A node that is found was in the
+ * tree at some point during the search, so it is returned as is; a miss
+ * is only trusted if no writer ran during the search, otherwise the search
+ * is repeated.
+ * @param tree pointer to a shared AVL tree
+ * @param key the key to look for
+ * @return the node matching key, NULL if there is none
+ */
+static const avl_node* avl_search_shared(const avl *tree, const data *key) {
+	avl_sync *sync = tree->sync;
+	const avl_node *node = NULL;
+	int done = 0;
+
+	AVL_COUNT(tree, lookups, 1);
+
+	while (!done) {
+		unsigned int version = atomic_load_explicit(&sync->version,
+				memory_order_acquire);
+		int steps = 0;
+		int found = 0;
+
+		node = AVL_LOAD(tree->root);
+
+		// A search longer than any valid path saw a rotation in progress.
+		while (node != NULL && !found && steps < AVL_MAX_HEIGHT) {
+			int comp = tree->compare(AVL_LOAD(node->value), key);
+
+			AVL_COUNT(tree, compares, 1);
+			AVL_COUNT(tree, path_length, 1);
+
+			if (comp < 0) {
+				node = AVL_LOAD(node->left);
+			} else if (comp > 0) {
+				node = AVL_LOAD(node->right);
+			} else {
+				found = 1;
+			}
+			steps++;
+		}
+		// The acquire loads above keep this check after them.
+		done = found
+				|| (node == NULL && (version & 1) == 0
+						&& atomic_load_explicit(&sync->version,
+								memory_order_relaxed) == version);
 	}
-	return index;
+	return node;
 }
 
 /**
- * Copies the contents of a node to an array location.
- * @param tree Pointer to a tree.
- * @param node Pointer to node.
- * @param values Array of values.
- * @param index Current index in array.
- * @return the updated index.
+ * Finds the left-most or right-most node while writers may be changing the
+ * tree. Must be called between avl_read_enter and avl_read_exit.
+ * @param tree pointer to a shared AVL tree
+ * @param left 1 to find the left-most node, 0 for the right-most node
+ * @return the node found, NULL if the tree is empty
  */
-static int avl_preorder_aux(const avl *tree, const avl_node *node,
-		data values[], int index) {
-
-	if (node != NULL) {
-		values[index] = *(node->value);
-		index++;
-		index = avl_preorder_aux(tree, node->left, values, index);
-		index = avl_preorder_aux(tree, node->right, values, index);
+static const avl_node* avl_extreme_shared(const avl *tree, int left) {
+	avl_sync *sync = tree->sync;
+	const avl_node *node = NULL;
+	int done = 0;
+
+	while (!done) {
+		unsigned int version = atomic_load_explicit(&sync->version,
+				memory_order_acquire);
+		const avl_node *next = AVL_LOAD(tree->root);
+		int steps = 0;
+
+		node = NULL;
+
+		while (next != NULL && steps < AVL_MAX_HEIGHT) {
+			node = next;
+			next = left ? AVL_LOAD(node->left) : AVL_LOAD(node->right);
+			steps++;
+		}
+		// The acquire loads above keep this check after them.
+		done = next == NULL && (version & 1) == 0
+				&& atomic_load_explicit(&sync->version, memory_order_relaxed)
+						== version;
 	}
-	return index;
+	return node;
 }
 
 /**
- * Copies the contents of a node to an array location.
- * @param tree Pointer to a tree.
- * @param node Pointer to node.
- * @param values Array of values.
- * @param index Current index in array.
- * @return the updated index.
+ * Helper function to determine the height of node - handles empty node.
+ * @param node The node to process.
+ * @return The height of the current node.
  */
-static int avl_postorder_aux(const avl *tree, const avl_node *node,
-		data values[], int index) {
+static int avl_node_height(const avl_node *node) {
+	int height = 0;
 
 	if (node != NULL) {
-		index = avl_postorder_aux(tree, node->left, values, index);
-		index = avl_postorder_aux(tree, node->right, values, index);
-		values[index] = *(node->value);
-		index++;
+		height = node->height;
 	}
-	return index;
+	return height;
 }
+
 /**
- * Returns the number of leaves (nodes with no children) in node.
+ * Helper function to determine the size of a subtree - handles empty node.
  * @param node The node to process.
- * @return The number of leaves for node and its children.
+ * @return The number of nodes in the subtree rooted at node.
  */
-static int avl_leaf_count_aux(const avl_node *node) {
+static int avl_node_count(const avl_node *node) {
 	int count = 0;
 
-	if (node == NULL) {
-		// Base case: no node.
-		count = 0;
-	} else if (node->left == NULL && node->right == NULL) {
-		// Base case: node has no children.
-		count = 1;
-	} else {
-		count = avl_leaf_count_aux(node->left)
-				+ avl_leaf_count_aux(node->right);
+	if (node != NULL) {
+		count = node->count;
 	}
 	return count;
 }
 
 /**
- * Returns the number of one child nodes in a AVL node.
+ * Helper function to determine the digest of a subtree - handles empty node.
+ * The node must belong to a tree that keeps digests.
  * @param node The node to process.
- * @return The number of one child nodes for node and its children.
+ * @return The digest of the subtree rooted at node, 0 if it is empty.
  */
-static int avl_one_child_count_aux(const avl_node *node) {
-	int count = 0;
+static uint64_t avl_node_digest(const avl_node *node) {
+	uint64_t digest = 0;
 
-	if (node == NULL) {
-		// Base case: empty node..
-		count = 0;
-	} else if (node->left == NULL && node->right != NULL) {
-		// General case: node has one child.
-		count = 1 + avl_one_child_count_aux(node->right);
-	} else if (node->left != NULL && node->right == NULL) {
-		// General case: node has one child.
-		count = 1 + avl_one_child_count_aux(node->left);
-	} else {
-		// General case: node has two children.
-		count = avl_one_child_count_aux(node->left)
-				+ avl_one_child_count_aux(node->right);
+	if (node != NULL) {
+		digest = AVL_DIGEST(node);
 	}
-	return count;
+	return digest;
 }
 
 /**
- * Returns the number of types of nodes in a AVL node.
+ * Returns the part of a node's digest that comes from its own value. The
+ * node must belong to a tree that keeps digests.
  * @param node The node to process.
- * @return The number of two children nodes for node and its children.
+ * @return The mixed hash of the node's value.
  */
-static int avl_two_child_count_aux(const avl_node *node) {
-	int count = 0;
+static uint64_t avl_node_own_digest(const avl_node *node) {
+	// Digests add modulo 2^64, so the children's parts can be subtracted.
+	return AVL_DIGEST(node) - avl_node_digest(node->left)
+			- avl_node_digest(node->right);
+}
 
-	if (node == NULL) {
-		// Base case: no node.
-		count = 0;
-	} else if (node->left != NULL && node->right != NULL) {
-		// General case: node has two children.
-		count = 1 + avl_two_child_count_aux(node->left)
-				+ avl_two_child_count_aux(node->right);
-	} else {
-		// General case: node has one child.
-		count = avl_two_child_count_aux(node->left)
-				+ avl_two_child_count_aux(node->right);
+/**
+ * Spreads the bits of a value hash (the splitmix64 finalizer), so that
+ * sums of the hashes of different sets of values rarely collide.
+ * @param hash A value hash.
+ * @return The mixed hash.
+ */
+static uint64_t avl_mix(uint64_t hash) {
+	hash += 0x9e3779b97f4a7c15u;
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9u;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebu;
+	return hash ^ (hash >> 31);
+}
+
+/**
+ * Updates the subtree size of a node from its children.
+ * @param node The node to process.
+ */
+static void avl_update_count(avl_node *node) {
+	node->count = avl_node_count(node->left) + avl_node_count(node->right) + 1;
+	return;
+}
+
+/**
+ * Recomputes the digest of a node from its value and its children, if the
+ * tree keeps digests. Hashes the value, so inserts and removes use
+ * avl_path_digest on their paths instead.
+ * @param tree pointer to a AVL tree
+ * @param node The node to process.
+ */
+static void avl_update_digest(const avl *tree, avl_node *node) {
+
+	if (tree->hash != NULL) {
+		AVL_DIGEST(node) = avl_mix(tree->hash(node->value))
+				+ avl_node_digest(node->left) + avl_node_digest(node->right);
 	}
-	return count;
+	return;
 }
 
 /**
- * Determines the number of zero, one, and two children nodes in a tree.
+ * Adds the change in the digest of a subtree to the digests of the nodes
+ * above it on a path, if the tree keeps digests.
+ * @param tree pointer to a AVL tree
+ * @param path Links to the nodes on the path, path[0] is the root link.
+ * @param first Index of the highest link to change.
+ * @param last Index of the lowest link to change.
+ * @param change Amount added to each digest, modulo 2^64.
+ */
+static void avl_path_digest(const avl *tree, avl_node **path[], int first,
+		int last, uint64_t change) {
+
+	if (tree->hash != NULL) {
+
+		for (int i = first; i <= last; i++) {
+			AVL_DIGEST(*path[i]) += change;
+		}
+	}
+	return;
+}
+
+/**
+ * Adds the digest of a new leaf to the digests of its ancestors, if the
+ * tree keeps digests.
+ * @param tree pointer to a AVL tree
+ * @param path Links to the nodes on the path, path[depth] links the leaf.
+ * @param depth Index of the link to the leaf.
+ */
+static void avl_path_grow(const avl *tree, avl_node **path[], int depth) {
+
+	if (tree->hash != NULL) {
+		avl_path_digest(tree, path, 0, depth - 1, AVL_DIGEST(*path[depth]));
+	}
+	return;
+}
+
+/**
+ * Sets the digest of a node whose children have changed from the digest of
+ * its own value, taken before the change, if the tree keeps digests.
+ * @param tree pointer to a AVL tree
  * @param node The node to process.
- * @param zero The number of zero children nodes for node and its children.
- * @param one The number of one child nodes for node and its children.
- * @param two The number of two children nodes for node and its children.
+ * @param own The digest of the node's value.
  */
-static void avl_node_counts_aux(const avl_node *node, int *zero, int *one,
-		int *two) {
+static void avl_set_digest(const avl *tree, avl_node *node, uint64_t own) {
 
-	if (node != NULL) {
+	if (tree->hash != NULL) {
+		AVL_DIGEST(node) = own + avl_node_digest(node->left)
+				+ avl_node_digest(node->right);
+	}
+	return;
+}
+
+/**
+ * Updates the height and subtree size of a node, but not its digest. Its
+ * height is the max of the heights of its child nodes, plus 1.
+ * @param node The node to process.
+ */
+static void avl_update_shape(avl_node *node) {
+	int left_height = avl_node_height(node->left);
+	int right_height = avl_node_height(node->right);
+
+	node->height = MAX_HEIGHT(left_height, right_height) + 1;
+	node->count = avl_node_count(node->left) + avl_node_count(node->right) + 1;
+	return;
+}
+
+/**
+ * Updates the height, subtree size and digest of a node.
+ * @param tree pointer to a AVL tree
+ * @param node The node to process.
+ */
+static void avl_update_node(const avl *tree, avl_node *node) {
+	avl_update_shape(node);
+	avl_update_digest(tree, node);
+	return;
+}
+
+/**
+ * Creates a leaf node that takes ownership of a value.
+ * @param tree pointer to a AVL tree
+ * @param value the value, destroyed with the node
+ * @return a pointer to a new leaf node
+ */
+static avl_node* avl_node_adopt(avl *tree, data *value) {
+	avl_node *node = avl_node_alloc(tree);
+
+	node->height = 1;
+	node->refs = 1;
+	node->left = NULL;
+	node->right = NULL;
+	node->value = value;
+	avl_update_count(node);
+	avl_update_digest(tree, node);
+	return node;
+}
+
+/**
+ * Initializes a new AVL node with a copy of value.
+ * @param tree pointer to a AVL tree
+ * @param value pointer to the value to assign to the node
+ * @return a pointer to a new AVL node
+ */
+static avl_node* avl_node_initialize(avl *tree, const data *value) {
+	// Base case: add a new node containing a copy of value.
+	AVL_COUNT(tree, copies, 1);
+	return avl_node_adopt(tree, tree->copy(value));
+}
+
+
+/**
+ * Drops a reference to a node. Destroys the node and drops its references
+ * to its children once no tree or parent refers to it any more.
+ * @param tree Pointer to a AVL.
+ * @param node The node to process.
+ */
+static void avl_destroy_aux(avl *tree, avl_node **node) {
+
+	if (*node != NULL) {
+		(*node)->refs--;
+
+		if ((*node)->refs == 0) {
+			avl_destroy_aux(tree, &(*node)->left);
+			avl_destroy_aux(tree, &(*node)->right);
+			tree->destroy(&(*node)->value);
+			AVL_COUNT(tree, destroys, 1);
+			(*node)->value = NULL;
+			avl_node_release(tree, *node);
+		}
+		*node = NULL;
+	}
+	return;
+}
+
+/**
+ * Makes sure the node a link points to belongs to this tree alone, so it
+ * can be changed. A node shared with a snapshot is replaced by a copy
+ * which takes over this tree's references to the node's children.
+ * @param tree Pointer to a AVL.
+ * @param link Pointer to the link to the node, which may be redirected.
+ * @return the node the link now points to.
+ */
+static avl_node* avl_node_own(avl *tree, avl_node **link) {
+	avl_node *node = *link;
+
+	if (node != NULL && node->refs > 1) {
+		avl_node *copy = avl_node_alloc(tree);
+
+		*copy = *node;
+		copy->refs = 1;
+		copy->value = tree->copy(node->value);
+		AVL_COUNT(tree, copies, 1);
+
+		if (tree->hash != NULL) {
+			AVL_DIGEST(copy) = AVL_DIGEST(node);
+		}
+		if (copy->left != NULL) {
+			copy->left->refs++;
+		}
+		if (copy->right != NULL) {
+			copy->right->refs++;
+		}
+		node->refs--;
+		*link = copy;
+		node = copy;
+	}
+	return node;
+}
+
+/**
+ * Performs a left rotation around node.
+ * @param tree Pointer to a AVL.
+ * @param node Pointer to the root of a subtree.
+ * @return Pointer to new root of subtree.
+ */
+static avl_node* avl_rotate_left(const avl *tree, avl_node *node) {
+	uint64_t digest = 0;
+	uint64_t own = 0;
+
+	if (tree->hash != NULL) {
+		// The subtree keeps its values, so the new root takes over its
+		// digest.
+		digest = AVL_DIGEST(node);
+		own = avl_node_own_digest(node);
+	}
+	// Rearrange the nodes.
+	avl_node *temp = node->right;
+	AVL_STORE(node->right, temp->left);
+	AVL_STORE(temp->left, node);
+	// Update the heights, sizes and digests.
+	avl_update_shape(node);
+	avl_update_shape(temp);
+
+	if (tree->hash != NULL) {
+		AVL_DIGEST(node) = own + avl_node_digest(node->left)
+				+ avl_node_digest(node->right);
+		AVL_DIGEST(temp) = digest;
+	}
+	// Return new root.
+	return temp;
+}
+
+/**
+ * Performs a right rotation around node.
+ * @param tree Pointer to a AVL.
+ * @param node Pointer to the root of a subtree.
+ * @return Pointer to new root of subtree.
+ */
+static avl_node* avl_rotate_right(const avl *tree, avl_node *node) {
+	uint64_t digest = 0;
+	uint64_t own = 0;
+
+	if (tree->hash != NULL) {
+		// The subtree keeps its values, so the new root takes over its
+		// digest.
+		digest = AVL_DIGEST(node);
+		own = avl_node_own_digest(node);
+	}
+	// Rearrange the nodes.
+	avl_node *temp = node->left;
+	AVL_STORE(node->left, temp->right);
+	AVL_STORE(temp->right, node);
+	// Update the heights, sizes and digests.
+	avl_update_shape(node);
+	avl_update_shape(temp);
+
+	if (tree->hash != NULL) {
+		AVL_DIGEST(node) = own + avl_node_digest(node->left)
+				+ avl_node_digest(node->right);
+		AVL_DIGEST(temp) = digest;
+	}
+	// Return new root.
+	return temp;
+}
+
+/**
+ * Determines whether an AVL node is balanced.
+ * @param node The node to process.
+ * @return an integer between -2 (right-heavy) and 2 (left-heavy)
+ */
+static int avl_balance_value(const avl_node *node) {
+	return avl_node_height(node->left) - avl_node_height(node->right);
+}
+
+/**
+ * Rebalances a node according to AVL rules. The node must belong to the
+ * tree alone; any child or grandchild that is rotated is made so first.
+ * The node's digest must already match its children, and the rotations
+ * keep it so.
+ * @param tree Pointer to a AVL.
+ * @param node Pointer to the node to rebalance.
+ */
+static void avl_rebalance(avl *tree, avl_node **node) {
+	// Update the node height and size if any of its children have been
+	// changed.
+	avl_update_shape(*node);
+	// Get the balance factor of this ancestor node to check whether
+	// this node became unbalanced
+	int balance = avl_balance_value(*node);
+	// If this node is unbalanced, then there are 4 cases
+
+	if (balance > 1) {
+		avl_node_own(tree, &(*node)->left);
+	} else if (balance < -1) {
+		avl_node_own(tree, &(*node)->right);
+	}
+
+	if (balance > 1 && avl_balance_value((*node)->left) >= 0) {
+		// Left Left Case - single rotation
+		AVL_STORE(*node, avl_rotate_right(tree, *node));
+		AVL_COUNT(tree, single_rotations, 1);
+	} else if (balance < -1 && avl_balance_value((*node)->right) <= 0) {
+		// Right Right Case - single rotation
+		AVL_STORE(*node, avl_rotate_left(tree, *node));
+		AVL_COUNT(tree, single_rotations, 1);
+	} else if (balance > 1 && avl_balance_value((*node)->left) < 0) {
+		// Left Right Case - double rotation
+		avl_node_own(tree, &(*node)->left->right);
+		AVL_STORE((*node)->left, avl_rotate_left(tree, (*node)->left));
+		AVL_STORE(*node, avl_rotate_right(tree, *node));
+		AVL_COUNT(tree, double_rotations, 1);
+	} else if (balance < -1 && avl_balance_value((*node)->right) > 0) {
+		// Right Left Case - double rotation
+		avl_node_own(tree, &(*node)->right->left);
+		AVL_STORE((*node)->right, avl_rotate_right(tree, (*node)->right));
+		AVL_STORE(*node, avl_rotate_left(tree, *node));
+		AVL_COUNT(tree, double_rotations, 1);
+	}
+	return;
+}
+
+/**
+ * Retraces a search path after an insert or remove, rebalancing from the
+ * bottom up. Stops rebalancing as soon as a subtree keeps its previous
+ * height, since none of the heights above it can have changed; the
+ * remaining ancestors only have their subtree sizes updated. Digests on
+ * the path must already include the change, see avl_path_digest.
+ * @param tree Pointer to a AVL.
+ * @param path Links to the nodes on the path, path[0] is the root link.
+ * @param depth Index of the deepest link to rebalance.
+ * @return the index of the highest link rebalanced. The nodes above it are
+ * the same nodes as before.
+ */
+static int avl_retrace(avl *tree, avl_node **path[], int depth) {
+	int i = depth;
+	int changed = 1;
+
+	while (i >= 0 && changed) {
+		int height = (*path[i])->height;
+		avl_rebalance(tree, path[i]);
+		changed = (*path[i])->height != height;
+		i--;
+	}
+	int top = i + 1;
+
+	while (i >= 0) {
+		// Subtree height is unchanged, but its size is not.
+		avl_update_count(*path[i]);
+		i--;
+	}
+	return top;
+}
+
+/**
+ * Retraces a search path after a remove from a weak AVL, where heights are
+ * ranks. The removal leaves a node a leaf of rank 1, or leaves its child
+ * three ranks down. Demotes nodes up the path while that holds, and ends
+ * with at most one single or double rotation, so a remove takes at most
+ * two rotations. The remaining ancestors only have their subtree sizes
+ * updated. Digests on the path must already include the change.
+ * @param tree Pointer to a AVL.
+ * @param path Links to the nodes on the path, path[depth + 1] is the link
+ * to the subtree that lost a node.
+ * @param depth Index of the link to the parent of that subtree.
+ */
+static void avl_weak_retrace(avl *tree, avl_node **path[], int depth) {
+	int i = depth;
+	int done = 0;
+
+	while (i >= 0 && !done) {
+		avl_node *node = *path[i];
+		int left = path[i + 1] == &node->left;
+		int height = node->height;
+
+		avl_update_count(node);
 
 		if (node->left == NULL && node->right == NULL) {
-			// Base case: leaf node
-			(*zero)++;
-		} else if (node->left == NULL && node->right != NULL) {
-			// One child - right
-			(*one)++;
-			avl_node_counts_aux(node->right, zero, one, two);
-		} else if (node->left != NULL && node->right == NULL) {
-			// One child - left
-			(*one)++;
-			avl_node_counts_aux(node->left, zero, one, two);
+			// A leaf is always at rank 0.
+			done = height == 1;
+			node->height = 1;
+		} else if (height - avl_node_height(*path[i + 1]) < 3) {
+			// The shorter subtree is still one or two ranks down.
+			done = 1;
 		} else {
-			// two children
-			(*two)++;
-			avl_node_counts_aux(node->left, zero, one, two);
-			avl_node_counts_aux(node->right, zero, one, two);
+			avl_node *sibling = avl_node_own(tree,
+					left ? &node->right : &node->left);
+			avl_node *outer = left ? sibling->right : sibling->left;
+			avl_node *inner = left ? sibling->left : sibling->right;
+			int sibling_height = sibling->height;
+
+			if (height - sibling_height == 2) {
+				// Demote the node, which may leave it three ranks down.
+				node->height--;
+			} else if (sibling_height - avl_node_height(outer) == 2
+					&& sibling_height - avl_node_height(inner) == 2) {
+				// Demote the node and its sibling together.
+				node->height--;
+				sibling->height--;
+			} else if (sibling_height - avl_node_height(outer) == 1) {
+				// Single rotation: the sibling takes the node's rank.
+				avl_node *top = left ? avl_rotate_left(tree, node)
+						: avl_rotate_right(tree, node);
+
+				AVL_STORE(*path[i], top);
+				sibling->height = height;
+				node->height = node->left == NULL && node->right == NULL ?
+						1 : height - 1;
+				AVL_COUNT(tree, single_rotations, 1);
+				done = 1;
+			} else {
+				// Double rotation: the inner child takes the node's rank.
+				inner = avl_node_own(tree,
+						left ? &sibling->left : &sibling->right);
+
+				if (left) {
+					AVL_STORE(node->right, avl_rotate_right(tree, sibling));
+					AVL_STORE(*path[i], avl_rotate_left(tree, node));
+				} else {
+					AVL_STORE(node->left, avl_rotate_left(tree, sibling));
+					AVL_STORE(*path[i], avl_rotate_right(tree, node));
+				}
+				inner->height = height;
+				sibling->height = sibling_height - 1;
+				node->height = height - 2;
+				AVL_COUNT(tree, double_rotations, 1);
+				done = 1;
+			}
 		}
+		i--;
+	}
+
+	while (i >= 0) {
+		// Subtree rank is unchanged, but its size is not.
+		avl_update_count(*path[i]);
+		i--;
 	}
 	return;
 }
 
 /**
- * Determines whether the AVL is balanced.
- * @param node The node to process.
- * @return 1 if the node and its children are balanced, 0 otherwise.
+ * Continues a search down from the last link of a path, recording the
+ * links followed on the way down. (Iterative)
+ * @param tree Pointer to a AVL.
+ * @param key The key to look for.
+ * @param path Array of AVL_MAX_HEIGHT links, filled in up to depth.
+ * @param depth Index in path of the link to start from, updated to the
+ * index of the link found.
+ * @return the link that points to the node matching key, or to the NULL
+ * child where key belongs.
  */
-static int avl_balanced_aux(const avl_node *node) {
-	int balanced = 0;
+static avl_node** avl_search_below(const avl *tree, const data *key,
+		avl_node **path[], int *depth) {
+	avl_node **link = path[*depth];
+	int d = *depth;
 
-	if (node == NULL || node->height == 1) {
-		// Base case: no node or a leaf, so no children.
-		balanced = 1;
-	} else if (abs(avl_node_height(node->left) - avl_node_height(node->right))
-			> 1) {
-		// Base case: left or right subtree is too deep.
-		balanced = 0;
-	} else {
-		// General case: check the children of node.
-		balanced = avl_balanced_aux(node->left)
-				&& avl_balanced_aux(node->right);
+	while (*link != NULL) {
+		int comp = tree->compare((*link)->value, key);
+
+		AVL_COUNT(tree, compares, 1);
+
+		if (comp < 0) {
+			link = &(*link)->left;
+		} else if (comp > 0) {
+			link = &(*link)->right;
+		} else {
+			break;
+		}
+		d++;
+		assert(d < AVL_MAX_HEIGHT);
+		path[d] = link;
 	}
-	return balanced;
+	*depth = d;
+	return link;
 }
 
 /**
- * Determines if a tree is a valid AVL.
- * @param tree pointer to a tree.
- * @param node The node to process.
- * @return 1 if the node and its children are valid, 0 otherwise.
+ * Finds the link where key is or would be stored, recording the links
+ * followed on the way down from the root. (Iterative)
+ * @param tree Pointer to a AVL.
+ * @param key The key to look for.
+ * @param path Array of AVL_MAX_HEIGHT links to fill in.
+ * @param depth Index in path of the link found.
+ * @return the link that points to the node matching key, or to the NULL
+ * child where key belongs.
  */
-static int avl_valid_aux(const avl *tree, const avl_node *node,
-		const avl_node *min_node, const avl_node *max_node) {
-	int valid = 0;
+static avl_node** avl_search_path(const avl *tree, const data *key,
+		avl_node **path[], int *depth) {
+	path[0] = (avl_node**) &tree->root;
+	*depth = 0;
+	return avl_search_below(tree, key, path, depth);
+}
 
-	if (node == NULL) {
-		// Base case: no node
-		valid = 1;
-	} else if (min_node != NULL
-			&& tree->LESS_THAN_EQUAL(min_node->value, node->value)) {
-		// Base case: node value less = than min_node value
-		valid = 0;
-	} else if (max_node != NULL
-			&& tree->GREATER_THAN_EQUAL(max_node->value, node->value)) {
-		// Base case: node value greater = max_node value
-		valid = 0;
-	} else if (abs(avl_node_height(node->left) - avl_node_height(node->right))
-			> 1) {
-		// Base case: height violation - child heights not balanced
+/**
+ * Finds how much of a finger's path a search for key can start from: the
+ * path down to the lowest node on it whose subtree must hold key. Climbs
+ * from the finger past each ancestor that key lies beyond, so a key d
+ * places from the finger is usually reached in O(log d) steps, and a key
+ * past the end of a finger on the last value in O(1).
+ * @param tree Pointer to a AVL.
+ * @param finger Pointer to a cursor into tree, may be past either end.
+ * @param key The key to look for.
+ * @return the number of nodes of the finger path to keep, 0 to start the
+ * search from the root.
+ */
+static int avl_finger_depth(const avl *tree, const avl_cursor *finger,
+		const data *key) {
+	int depth = 0;
+
+	// A change to the tree may have freed or moved the finger's nodes.
+	if (finger->tree == tree && finger->changes == tree->changes
+			&& finger->depth > 0 && tree->sync == NULL) {
+		const avl_node *node = finger->path[finger->depth - 1];
+		int comp = tree->compare(node->value, key);
+		int done = comp == 0;
+		int i = finger->depth - 1;
+
+		AVL_COUNT(tree, compares, 1);
+		depth = finger->depth;
+
+		while (!done && i > 0) {
+			const avl_node *parent = finger->path[i - 1];
+
+			// Only an ancestor on the far side of the finger can bound key.
+			if ((comp < 0 ? parent->right : parent->left)
+					== finger->path[i]) {
+				int beyond = tree->compare(parent->value, key);
+
+				AVL_COUNT(tree, compares, 1);
+
+				if (beyond == 0 || (beyond < 0) == (comp < 0)) {
+					// key is past the parent too, or is the parent.
+					depth = i;
+					done = beyond == 0;
+				} else {
+					done = 1;
+				}
+			}
+			i--;
+		}
+	}
+	return depth;
+}
+
+/**
+ * Makes every node on a search path belong to the tree alone, top down,
+ * redirecting the path into any copies made.
+ * @param tree Pointer to a AVL.
+ * @param path Links to the nodes on the path, path[0] is the root link.
+ * @param depth Index of the deepest link on the path.
+ */
+static void avl_path_own(avl *tree, avl_node **path[], int depth) {
+
+	for (int i = 0; i <= depth && *path[i] != NULL; i++) {
+		avl_node *old = *path[i];
+		avl_node *node = avl_node_own(tree, path[i]);
+
+		if (node != old && i < depth) {
+			// The next link lives in the copy now.
+			path[i + 1] = path[i + 1] == &old->left ?
+					&node->left : &node->right;
+		}
+	}
+	return;
+}
+
+/**
+ * Unlinks the node at path[depth] from the tree and rebalances the tree.
+ * The nodes on the path must belong to the tree alone.
+ * @param tree Pointer to a AVL.
+ * @param path Links to the nodes on the path to the node.
+ * @param depth Index in path of the link to the node.
+ * @return the unlinked node.
+ */
+static avl_node* avl_unlink(avl *tree, avl_node **path[], int depth) {
+	avl_node *target = *path[depth];
+	avl_node *repl = NULL;
+	uint64_t own = tree->hash != NULL ? avl_node_own_digest(target) : 0;
+	int d = depth;
+
+	// The ancestors lose the target's value.
+	avl_path_digest(tree, path, 0, depth - 1, -own);
+
+	if (target->left == NULL) {
+		// node has no left child.
+		AVL_STORE(*path[d], target->right);
+		d--;
+	} else if (target->right == NULL) {
+		// node has no right child.
+		AVL_STORE(*path[d], target->left);
+		d--;
+	} else {
+		// Node has two children - the replacement node is the largest node
+		// in its left subtree.
+		d++;
+		path[d] = &target->left;
+
+		while (avl_node_own(tree, path[d])->right != NULL) {
+			d++;
+			assert(d < AVL_MAX_HEIGHT);
+			path[d] = &(*path[d - 1])->right;
+		}
+		repl = *path[d];
+		// The nodes between the target and the replacement node lose the
+		// replacement's value, which takes over the target's digest less
+		// the target's own value.
+		if (tree->hash != NULL) {
+			avl_path_digest(tree, path, depth + 1, d - 1,
+					-avl_node_own_digest(repl));
+			AVL_DIGEST(repl) = AVL_DIGEST(target) - own;
+		}
+		// Move the replacement node's left tree up.
+		AVL_STORE(*path[d], repl->left);
+		// The replacement node takes over the removed node's place.
+		AVL_STORE(repl->left, target->left);
+		AVL_STORE(repl->right, target->right);
+		repl->height = target->height;
+		repl->count = target->count;
+		AVL_STORE(*path[depth], repl);
+		// The path now runs through the replacement node.
+		path[depth + 1] = &repl->left;
+		d--;
+	}
+
+	if (tree->balance == AVL_BALANCE_WEAK) {
+		avl_weak_retrace(tree, path, d);
+	} else {
+		avl_retrace(tree, path, d);
+	}
+	tree->size--;
+	return target;
+}
+
+/**
+ * Builds a perfectly balanced subtree from the next n values of a source.
+ * The left subtree is built first so values are consumed in order.
+ * @param tree Pointer to a AVL.
+ * @param next Function returning the next value.
+ * @param context Caller state passed to next.
+ * @param n Number of nodes in the subtree.
+ * @return Pointer to the root of the new subtree.
+ */
+static avl_node* avl_build_aux(avl *tree, avl_source next, void *context,
+		int n) {
+	avl_node *node = NULL;
+
+	if (n > 0) {
+		// Subtree sizes differ by at most one, so heights do too.
+		int left_count = (n - 1) / 2;
+		avl_node *left = avl_build_aux(tree, next, context, left_count);
+		const data *value = next(context);
+		assert(value != NULL);
+
+		node = avl_node_initialize(tree, value);
+		node->left = left;
+		node->right = avl_build_aux(tree, next, context, n - 1 - left_count);
+		avl_update_node(tree, node);
+	}
+	return node;
+}
+
+/**
+ * State for reading the values of an array as an avl_source.
+ */
+typedef struct {
+	const data *values; ///< Array of values.
+	int index; ///< Index of the next value to return.
+} avl_array_source;
+
+/**
+ * Returns the next value in an array. (avl_source for avl_build_sorted.)
+ * @param context Pointer to an avl_array_source.
+ * @return Pointer to the next value in the array.
+ */
+static const data* avl_array_next(void *context) {
+	avl_array_source *source = context;
+	return &source->values[source->index++];
+}
+
+/**
+ * Disposes of an unlinked subtree and its values.
+ * @param tree pointer to a AVL tree
+ * @param node root of the unlinked subtree
+ */
+static void avl_discard_aux(avl *tree, avl_node *node) {
+
+	if (tree->sync == NULL) {
+		avl_destroy_aux(tree, &node);
+	} else if (node != NULL) {
+		avl_discard_aux(tree, node->left);
+		avl_discard_aux(tree, node->right);
+		avl_node_discard(tree, node);
+	}
+	return;
+}
+
+/**
+ * Joins two subtrees around a middle node. Every value in left comes
+ * before mid's value, and every value in right comes after it. Descends the
+ * spine of the taller subtree to a node of about the height of the other
+ * one, so it runs in O(|height(left) - height(right)|).
+ * @param tree Pointer to a AVL.
+ * @param left Root of the left subtree, may be NULL.
+ * @param mid The middle node, owned by the tree and unlinked.
+ * @param right Root of the right subtree, may be NULL.
+ * @return the root of the joined subtree.
+ */
+static avl_node* avl_join_aux(avl *tree, avl_node *left, avl_node *mid,
+		avl_node *right) {
+	avl_node *root = NULL;
+
+	if (avl_node_height(left) > avl_node_height(right) + 1) {
+		// Join into the right spine of the taller left subtree.
+		avl_node_own(tree, &left);
+		uint64_t own = tree->hash != NULL ? avl_node_own_digest(left) : 0;
+		AVL_STORE(left->right, avl_join_aux(tree, left->right, mid, right));
+		avl_set_digest(tree, left, own);
+		avl_rebalance(tree, &left);
+		root = left;
+	} else if (avl_node_height(right) > avl_node_height(left) + 1) {
+		// Join into the left spine of the taller right subtree.
+		avl_node_own(tree, &right);
+		uint64_t own = tree->hash != NULL ? avl_node_own_digest(right) : 0;
+		AVL_STORE(right->left, avl_join_aux(tree, left, mid, right->left));
+		avl_set_digest(tree, right, own);
+		avl_rebalance(tree, &right);
+		root = right;
+	} else {
+		// Heights are close enough for mid to be the root.
+		AVL_STORE(mid->left, left);
+		AVL_STORE(mid->right, right);
+		avl_update_node(tree, mid);
+		root = mid;
+	}
+	return root;
+}
+
+/**
+ * Unlinks the last node of a subtree.
+ * @param tree Pointer to a AVL.
+ * @param node Root of a non-empty subtree.
+ * @param last Set to the unlinked node.
+ * @return the root of the rest of the subtree.
+ */
+static avl_node* avl_split_last(avl *tree, avl_node *node, avl_node **last) {
+	avl_node *root = NULL;
+
+	avl_node_own(tree, &node);
+
+	if (node->right == NULL) {
+		root = node->left;
+		*last = node;
+	} else {
+		avl_node *rest = avl_split_last(tree, node->right, last);
+		root = avl_join_aux(tree, node->left, node, rest);
+	}
+	return root;
+}
+
+/**
+ * Joins two subtrees where every value in left comes before every value
+ * in right.
+ * @param tree Pointer to a AVL.
+ * @param left Root of the left subtree, may be NULL.
+ * @param right Root of the right subtree, may be NULL.
+ * @return the root of the joined subtree.
+ */
+static avl_node* avl_join2(avl *tree, avl_node *left, avl_node *right) {
+	avl_node *root = right;
+
+	if (left != NULL) {
+		avl_node *mid = NULL;
+		avl_node *rest = avl_split_last(tree, left, &mid);
+		root = avl_join_aux(tree, rest, mid, right);
+	}
+	return root;
+}
+
+/**
+ * Splits a subtree around key.
+ * @param tree Pointer to a AVL.
+ * @param node Root of the subtree, may be NULL.
+ * @param key The key to split around.
+ * @param left Set to the root of the values before key.
+ * @param right Set to the root of the values after key.
+ * @return the unlinked node matching key, NULL if there is none.
+ */
+static avl_node* avl_split_aux(avl *tree, avl_node *node, const data *key,
+		avl_node **left, avl_node **right) {
+	avl_node *found = NULL;
+
+	if (node == NULL) {
+		*left = NULL;
+		*right = NULL;
+	} else {
+		avl_node_own(tree, &node);
+		int comp = tree->compare(node->value, key);
+		avl_node *l = node->left;
+		avl_node *r = node->right;
+
+		if (comp < 0) {
+			found = avl_split_aux(tree, l, key, left, &l);
+			*right = avl_join_aux(tree, l, node, r);
+		} else if (comp > 0) {
+			found = avl_split_aux(tree, r, key, &r, right);
+			*left = avl_join_aux(tree, l, node, r);
+		} else {
+			*left = l;
+			*right = r;
+			AVL_STORE(node->left, NULL);
+			AVL_STORE(node->right, NULL);
+			avl_update_node(tree, node);
+			found = node;
+		}
+	}
+	return found;
+}
+
+/**
+ * Destroys a node that was unlinked from a subtree, and its value.
+ * @param tree Pointer to a AVL.
+ * @param node The unlinked node.
+ */
+static void avl_node_drop(avl *tree, avl_node *node) {
+	// The node's children have been moved elsewhere.
+	node->left = NULL;
+	node->right = NULL;
+	avl_destroy_aux(tree, &node);
+	return;
+}
+
+/**
+ * Merges two subtrees. Values in source that match values in target are
+ * destroyed.
+ * @param tree Pointer to a AVL.
+ * @param target Root of a subtree of the target tree.
+ * @param source Root of a subtree of the source tree.
+ * @return the root of the merged subtree.
+ */
+static avl_node* avl_union_aux(avl *tree, avl_node *target, avl_node *source) {
+	avl_node *root = target;
+
+	if (target == NULL) {
+		root = source;
+	} else if (source != NULL) {
+		avl_node *left = NULL;
+		avl_node *right = NULL;
+		avl_node *found = avl_split_aux(tree, source, target->value, &left,
+				&right);
+
+		if (found != NULL) {
+			avl_node_drop(tree, found);
+		}
+		avl_node_own(tree, &target);
+		left = avl_union_aux(tree, target->left, left);
+		right = avl_union_aux(tree, target->right, right);
+		root = avl_join_aux(tree, left, target, right);
+	}
+	return root;
+}
+
+/**
+ * Keeps the values of a target subtree that are also in a source subtree.
+ * All the source nodes are destroyed.
+ * @param tree Pointer to a AVL.
+ * @param target Root of a subtree of the target tree.
+ * @param source Root of a subtree of the source tree.
+ * @return the root of the remaining subtree.
+ */
+static avl_node* avl_intersection_aux(avl *tree, avl_node *target,
+		avl_node *source) {
+	avl_node *root = NULL;
+
+	if (target == NULL || source == NULL) {
+		avl_destroy_aux(tree, &target);
+		avl_destroy_aux(tree, &source);
+	} else {
+		avl_node *left = NULL;
+		avl_node *right = NULL;
+		avl_node *found = avl_split_aux(tree, source, target->value, &left,
+				&right);
+
+		avl_node_own(tree, &target);
+		left = avl_intersection_aux(tree, target->left, left);
+		right = avl_intersection_aux(tree, target->right, right);
+
+		if (found != NULL) {
+			avl_node_drop(tree, found);
+			root = avl_join_aux(tree, left, target, right);
+		} else {
+			avl_node_drop(tree, target);
+			root = avl_join2(tree, left, right);
+		}
+	}
+	return root;
+}
+
+/**
+ * Removes the values of a source subtree from a target subtree. All the
+ * source nodes are destroyed.
+ * @param tree Pointer to a AVL.
+ * @param target Root of a subtree of the target tree.
+ * @param source Root of a subtree of the source tree.
+ * @return the root of the remaining subtree.
+ */
+static avl_node* avl_difference_aux(avl *tree, avl_node *target,
+		avl_node *source) {
+	avl_node *root = target;
+
+	if (target == NULL || source == NULL) {
+		avl_destroy_aux(tree, &source);
+	} else {
+		avl_node *left = NULL;
+		avl_node *right = NULL;
+		avl_node *found = avl_split_aux(tree, source, target->value, &left,
+				&right);
+
+		avl_node_own(tree, &target);
+		left = avl_difference_aux(tree, target->left, left);
+		right = avl_difference_aux(tree, target->right, right);
+
+		if (found != NULL) {
+			avl_node_drop(tree, found);
+			avl_node_drop(tree, target);
+			root = avl_join2(tree, left, right);
+		} else {
+			root = avl_join_aux(tree, left, target, right);
+		}
+	}
+	return root;
+}
+
+/**
+ * Recomputes the digests of a subtree with the tree's hash function. Nodes
+ * shared with a snapshot are copied first.
+ * @param tree Pointer to a AVL.
+ * @param link Pointer to the link to the subtree.
+ */
+static void avl_digest_aux(avl *tree, avl_node **link) {
+
+	if (*link != NULL) {
+		avl_node *node = avl_node_own(tree, link);
+
+		avl_digest_aux(tree, &node->left);
+		avl_digest_aux(tree, &node->right);
+		avl_update_digest(tree, node);
+	}
+	return;
+}
+
+/**
+ * Moves a subtree into the target's allocator and node layout. Nodes that
+ * source shares with a snapshot are copied rather than moved. Digests are
+ * carried over only if both trees keep them.
+ * @param target Pointer to the AVL taking over the nodes.
+ * @param source Pointer to the AVL the nodes were allocated by.
+ * @param link Pointer to the link to the subtree.
+ */
+static void avl_rehome(avl *target, avl *source, avl_node **link) {
+	avl_node *node = *link;
+
+	if (node != NULL) {
+		avl_node *copy = avl_node_alloc(target);
+
+		*copy = *node;
+
+		if (target->hash != NULL && source->hash != NULL) {
+			AVL_DIGEST(copy) = AVL_DIGEST(node);
+		}
+		if (node->refs > 1) {
+			copy->refs = 1;
+			copy->value = target->copy(node->value);
+			AVL_COUNT(target, copies, 1);
+
+			if (copy->left != NULL) {
+				copy->left->refs++;
+			}
+			if (copy->right != NULL) {
+				copy->right->refs++;
+			}
+			node->refs--;
+		} else {
+			avl_node_release(source, node);
+		}
+		*link = copy;
+		avl_rehome(target, source, &copy->left);
+		avl_rehome(target, source, &copy->right);
+	}
+	return;
+}
+
+/**
+ * Prepares to move the nodes of source into target. Moves them into the
+ * target's allocator if the trees use different ones, or nodes of
+ * different sizes, and empties source.
+ * @param target Pointer to the AVL taking over the nodes.
+ * @param source Pointer to the AVL giving up its nodes.
+ * @return the root of the source nodes.
+ */
+static avl_node* avl_take(avl *target, avl *source) {
+	assert(target != source);
+	assert(target->sync == NULL && source->sync == NULL);
+	// Every AVL is a valid weak AVL, but not the other way round.
+	assert(target->balance == AVL_BALANCE_WEAK
+			|| source->balance == AVL_BALANCE_STRICT);
+
+	if (target->pool != source->pool
+			|| avl_node_size(target) != avl_node_size(source)) {
+		avl_rehome(target, source, &source->root);
+	}
+	if (target->hash != source->hash) {
+		avl_digest_aux(target, &source->root);
+	}
+	avl_node *root = source->root;
+	source->root = NULL;
+	source->size = 0;
+	source->changes++;
+	target->changes++;
+	return root;
+}
+
+/**
+ * A run of values sorted or merged by one thread of avl_insert_batch.
+ */
+typedef struct {
+	const avl *tree; ///< Pointer to the AVL, for its compare function.
+	const data **keys; ///< The values to sort or merge.
+	const data **temp; ///< Scratch space, or where merged values go.
+	int n; ///< Number of values in the run.
+	int mid; ///< Start of the second half when merging, -1 to sort.
+} avl_sort_task;
+
+/**
+ * A piece of a AVL filled by one thread of avl_insert_batch.
+ */
+typedef struct {
+	avl tree; ///< Header for the piece of the AVL.
+	avl_pool pool; ///< Nodes reserved for the thread in a pooled AVL.
+	const data **keys; ///< The sorted values to insert.
+	int n; ///< Number of values in keys.
+	int inserted; ///< Number of values inserted.
+} avl_batch_task;
+
+/**
+ * Merges two sorted runs. Ties are taken from the first run, so merging
+ * is stable.
+ * @param tree Pointer to a AVL.
+ * @param src Array holding the two runs.
+ * @param mid Start of the second run.
+ * @param n Number of values in both runs.
+ * @param dst Array that receives the merged values.
+ */
+static void avl_merge(const avl *tree, const data **src, int mid, int n,
+		const data **dst) {
+	int i = 0;
+	int j = mid;
+	int k = 0;
+
+	while (i < mid && j < n) {
+		if (tree->compare(src[i], src[j]) < 0) {
+			dst[k++] = src[j++];
+		} else {
+			dst[k++] = src[i++];
+		}
+	}
+	while (i < mid) {
+		dst[k++] = src[i++];
+	}
+	while (j < n) {
+		dst[k++] = src[j++];
+	}
+	return;
+}
+
+/**
+ * Sorts values into tree order with a stable merge sort.
+ * @param tree Pointer to a AVL.
+ * @param keys Array of values to sort.
+ * @param temp Scratch array as long as keys.
+ * @param n Number of values.
+ */
+static void avl_sort_aux(const avl *tree, const data **keys,
+		const data **temp, int n) {
+
+	if (n > 1) {
+		int mid = n / 2;
+
+		avl_sort_aux(tree, keys, temp, mid);
+		avl_sort_aux(tree, keys + mid, temp, n - mid);
+		avl_merge(tree, keys, mid, n, temp);
+		memcpy(keys, temp, n * sizeof *keys);
+	}
+	return;
+}
+
+/**
+ * Sorts or merges one run. (Thread function.)
+ * @param arg Pointer to an avl_sort_task.
+ * @return NULL.
+ */
+static void* avl_sort_thread(void *arg) {
+	avl_sort_task *task = arg;
+
+	if (task->mid < 0) {
+		avl_sort_aux(task->tree, task->keys, task->temp, task->n);
+	} else {
+		avl_merge(task->tree, task->keys, task->mid, task->n, task->temp);
+	}
+	return NULL;
+}
+
+/**
+ * Inserts the values of one piece of a batch. (Thread function.)
+ * @param arg Pointer to an avl_batch_task.
+ * @return NULL.
+ */
+static void* avl_batch_thread(void *arg) {
+	avl_batch_task *task = arg;
+
+	for (int i = 0; i < task->n; i++) {
+		task->inserted += avl_insert(&task->tree, task->keys[i]);
+	}
+	return NULL;
+}
+
+/**
+ * Runs a function on each of an array of tasks, one thread per task, and
+ * waits for them all. The calling thread runs the first task. Does
+ * nothing if there are no tasks.
+ * @param work The thread function.
+ * @param tasks Array of tasks.
+ * @param size Size of one task.
+ * @param count Number of tasks.
+ */
+static void avl_fork_join(void* (*work)(void*), void *tasks, size_t size,
+		int count) {
+	char *task = tasks;
+
+	if (count > 0) {
+		pthread_t *threads = malloc(count * sizeof *threads);
+		assert(threads != NULL);
+
+		for (int i = 1; i < count; i++) {
+			int result = pthread_create(&threads[i], NULL, work,
+					task + i * size);
+			assert(result == 0);
+			(void) result;
+		}
+		work(task);
+
+		for (int i = 1; i < count; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		free(threads);
+	}
+	return;
+}
+
+/**
+ * Sorts values into tree order. Equal runs are sorted in parallel, then
+ * merged pairwise in parallel until one run is left.
+ * @param tree Pointer to a AVL.
+ * @param keys Array of values to sort.
+ * @param temp Scratch array as long as keys.
+ * @param n Number of values.
+ * @param nthreads Number of threads to use.
+ */
+static void avl_batch_sort(const avl *tree, const data **keys,
+		const data **temp, int n, int nthreads) {
+	avl_sort_task *tasks = malloc(nthreads * sizeof *tasks);
+	assert(tasks != NULL);
+	const data **src = keys;
+	const data **dst = temp;
+	int width = (n + nthreads - 1) / nthreads;
+	int count = 0;
+
+	for (int lo = 0; lo < n; lo += width) {
+		avl_sort_task task = { tree, keys + lo, temp + lo, n - lo, -1 };
+
+		if (task.n > width) {
+			task.n = width;
+		}
+		tasks[count++] = task;
+	}
+	avl_fork_join(avl_sort_thread, tasks, sizeof *tasks, count);
+
+	for (; width < n; width *= 2) {
+		count = 0;
+
+		for (int lo = 0; lo < n; lo += 2 * width) {
+			avl_sort_task task = { tree, src + lo, dst + lo, n - lo, width };
+
+			if (task.n > 2 * width) {
+				task.n = 2 * width;
+			}
+			if (task.mid > task.n) {
+				task.mid = task.n;
+			}
+			tasks[count++] = task;
+		}
+		avl_fork_join(avl_sort_thread, tasks, sizeof *tasks, count);
+		src = dst;
+		dst = src == keys ? temp : keys;
+	}
+	if (src != keys) {
+		memcpy(keys, src, n * sizeof *keys);
+	}
+	free(tasks);
+	return;
+}
+
+#ifdef AVL_STATS
+/**
+ * Adds the event counts of one tree to another.
+ * @param to The counts to add to.
+ * @param from The counts to add, which readers may still be counting.
+ */
+static void avl_counters_add(avl_counters *to, const avl_counters *from) {
+	to->inserts += AVL_LOAD(from->inserts);
+	to->removes += AVL_LOAD(from->removes);
+	to->lookups += AVL_LOAD(from->lookups);
+	to->compares += AVL_LOAD(from->compares);
+	to->path_length += AVL_LOAD(from->path_length);
+	to->single_rotations += AVL_LOAD(from->single_rotations);
+	to->double_rotations += AVL_LOAD(from->double_rotations);
+	to->allocations += AVL_LOAD(from->allocations);
+	to->copies += AVL_LOAD(from->copies);
+	to->destroys += AVL_LOAD(from->destroys);
+	return;
+}
+#endif
+
+/**
+ * Inserts sorted, distinct values into a AVL in parallel. The tree is split
+ * at the first value of each thread's share, each thread inserts into its
+ * own piece, and the pieces are joined again.
+ * @param tree Pointer to a AVL with no nodes shared with another tree.
+ * @param keys Array of sorted, distinct values.
+ * @param n Number of values.
+ * @param nthreads Number of threads to use.
+ * @return the number of values inserted.
+ */
+static int avl_batch_insert(avl *tree, const data **keys, int n,
+		int nthreads) {
+	avl_batch_task *tasks = malloc(nthreads * sizeof *tasks);
+	assert(tasks != NULL);
+	avl_node *rest = tree->root;
+	int width = (n + nthreads - 1) / nthreads;
+	int count = (n + width - 1) / width;
+	int inserted = 0;
+
+	// Cut the pieces off from the right.
+	for (int i = count - 1; i >= 0; i--) {
+		avl_batch_task *task = &tasks[i];
+
+		task->tree = *tree;
+#ifdef AVL_STATS
+		memset(&task->tree.counters, 0, sizeof task->tree.counters);
+#endif
+		task->keys = keys + i * width;
+		task->n = i == count - 1 ? n - i * width : width;
+		task->inserted = 0;
+
+		if (i > 0) {
+			avl_node *found = avl_split_aux(tree, rest, task->keys[0], &rest,
+					&task->tree.root);
+
+			if (found != NULL) {
+				task->tree.root = avl_join_aux(tree, NULL, found,
+						task->tree.root);
+			}
+		} else {
+			task->tree.root = rest;
+		}
+		if (tree->pool != NULL) {
+			// The pool is not thread safe: reserve a node for every value.
+			task->pool = *tree->pool;
+			task->pool.chunks = NULL;
+			task->pool.free = NULL;
+
+			for (int j = 0; j < task->n; j++) {
+				avl_node *node = avl_node_alloc(tree);
+
+				node->right = task->pool.free;
+				task->pool.free = node;
+			}
+			// The task counts each node again when it hands it to a value.
+			AVL_COUNT(tree, allocations, -task->n);
+			task->tree.pool = &task->pool;
+		}
+	}
+	avl_fork_join(avl_batch_thread, tasks, sizeof *tasks, count);
+	tree->root = NULL;
+
+	for (int i = 0; i < count; i++) {
+		tree->root = avl_join2(tree, tree->root, tasks[i].tree.root);
+		inserted += tasks[i].inserted;
+#ifdef AVL_STATS
+		avl_counters_add(&tree->counters, &tasks[i].tree.counters);
+#endif
+
+		if (tree->pool != NULL) {
+			// Give back the nodes that went to duplicates.
+			while (tasks[i].pool.free != NULL) {
+				avl_node *node = tasks[i].pool.free;
+
+				tasks[i].pool.free = node->right;
+				avl_node_release(tree, node);
+			}
+		}
+	}
+	tree->size += inserted;
+	free(tasks);
+	return inserted;
+}
+
+/**
+ * Fills the subtree of a frozen image rooted at index k from a cursor.
+ * @param values The image array.
+ * @param n Number of values in the image.
+ * @param k Index of the subtree root.
+ * @param cursor Cursor at the next value of the tree, in order.
+ */
+static void avl_freeze_aux(data values[], int n, int k, avl_cursor *cursor) {
+
+	if (k <= n) {
+		avl_freeze_aux(values, n, 2 * k, cursor);
+		values[k] = *avl_cursor_value(cursor);
+		avl_next(cursor);
+		avl_freeze_aux(values, n, 2 * k + 1, cursor);
+	}
+	return;
+}
+
+/**
+ * Finds the first value in a frozen image that does not come before key.
+ * The loop does the same work at every level whatever the comparison
+ * result, and prefetches four levels ahead.
+ * @param image Pointer to a frozen image.
+ * @param key Key value to search for.
+ * @return index of the value, 0 if every value comes before key.
+ */
+static int avl_frozen_lower(const avl_frozen *image, const data *key) {
+	const data *values = image->values;
+	unsigned int n = image->size;
+	unsigned int k = 1;
+
+	while (k <= n) {
+		__builtin_prefetch(&values[AVL_FROZEN_AHEAD(k) <= n ?
+				AVL_FROZEN_AHEAD(k) : 0]);
+		k = 2 * k + (image->compare(&values[k], key) > 0);
+	}
+	// Undo the right turns taken after the last left turn.
+	k >>= __builtin_ffs(~k);
+	return k;
+}
+
+/**
+ * Returns the index after k in the order of a frozen image.
+ * @param n Number of values in the image.
+ * @param k Index of a value.
+ * @return index of the next value, 0 if k is the last.
+ */
+static int avl_frozen_next(unsigned int n, unsigned int k) {
+
+	if (2 * k + 1 <= n) {
+		// Leftmost value of the right subtree.
+		k = 2 * k + 1;
+
+		while (2 * k <= n) {
+			k = 2 * k;
+		}
+	} else {
+		// Climb past the ancestors whose right subtree k is in.
+		k >>= __builtin_ffs(~k);
+	}
+	return k;
+}
+
+/**
+ * State for reading the records of a file loaded by avl_load.
+ */
+typedef struct {
+	const unsigned char *next; ///< Start of the next record.
+	data_deserialize deserialize; ///< Makes a value from a record.
+	const data *last; ///< Last value read, NULL before the first.
+	int ok; ///< 0 once a record has failed to load or is out of order.
+} avl_file_reader;
+
+/**
+ * Checks that a file's records fill its contents exactly, so that reading
+ * them cannot run past the end.
+ * @param next Start of the first record.
+ * @param end End of the file contents.
+ * @param count Number of records the file should hold.
+ * @return 1 if the records fit, 0 otherwise.
+ */
+static int avl_file_check(const unsigned char *next, const unsigned char *end,
+		uint32_t count) {
+	uint32_t length = 0;
+	int fits = 1;
+
+	while (fits && count > 0) {
+		fits = (size_t) (end - next) >= sizeof length;
+
+		if (fits) {
+			memcpy(&length, next, sizeof length);
+			next += sizeof length;
+			fits = (size_t) (end - next) >= length;
+			next += fits ? length : 0;
+			count--;
+		}
+	}
+	return fits && next == end;
+}
+
+/**
+ * Builds a perfectly balanced subtree from the next n records of a file.
+ * As in avl_build_aux, the left subtree is built first. Stops reading at
+ * the first record that cannot be made into a value or that does not come
+ * after the one before it, and clears reader->ok; the nodes already built
+ * are still linked into the subtree returned, so they can be destroyed.
+ * @param tree Pointer to a AVL.
+ * @param reader The file being read.
+ * @param n Number of nodes in the subtree.
+ * @return Pointer to the root of the new subtree.
+ */
+static avl_node* avl_load_aux(avl *tree, avl_file_reader *reader, int n) {
+	avl_node *node = NULL;
+
+	if (n > 0 && reader->ok) {
+		int left_count = (n - 1) / 2;
+		avl_node *left = avl_load_aux(tree, reader, left_count);
+		data *value = NULL;
+		uint32_t length = 0;
+
+		if (reader->ok) {
+			memcpy(&length, reader->next, sizeof length);
+			reader->next += sizeof length;
+			value = reader->deserialize(reader->next, length);
+			reader->next += length;
+
+			if (value == NULL) {
+				reader->ok = 0;
+			} else if (reader->last != NULL
+					&& tree->compare(reader->last, value) <= 0) {
+				// Out of order or repeated: the file is not a AVL.
+				tree->destroy(&value);
+				reader->ok = 0;
+			}
+		}
+		if (reader->ok) {
+			// The deserialized value is owned by the node, not copied.
+			node = avl_node_adopt(tree, value);
+			reader->last = value;
+			node->left = left;
+			node->right = avl_load_aux(tree, reader, n - 1 - left_count);
+			avl_update_node(tree, node);
+		} else {
+			node = left;
+		}
+	}
+	return node;
+}
+
+/**
+ * Sums the digests of the values of a subtree that come after lo.
+ * @param tree Pointer to a AVL.
+ * @param node Root of the subtree.
+ * @param lo Lower key value, exclusive, NULL for no bound.
+ * @return the digest of the values after lo.
+ */
+static uint64_t avl_digest_after(const avl *tree, const avl_node *node,
+		const data *lo) {
+	uint64_t digest = 0;
+
+	if (lo == NULL) {
+		digest = avl_node_digest(node);
+	} else {
+		while (node != NULL) {
+
+			if (tree->compare(node->value, lo) < 0) {
+				// node and its right subtree come after lo.
+				digest += avl_node_own_digest(node)
+						+ avl_node_digest(node->right);
+				node = node->left;
+			} else {
+				node = node->right;
+			}
+		}
+	}
+	return digest;
+}
+
+/**
+ * Sums the digests of the values of a subtree that come before hi.
+ * @param tree Pointer to a AVL.
+ * @param node Root of the subtree.
+ * @param hi Upper key value, exclusive, NULL for no bound.
+ * @return the digest of the values before hi.
+ */
+static uint64_t avl_digest_before(const avl *tree, const avl_node *node,
+		const data *hi) {
+	uint64_t digest = 0;
+
+	if (hi == NULL) {
+		digest = avl_node_digest(node);
+	} else {
+		while (node != NULL) {
+
+			if (tree->compare(node->value, hi) > 0) {
+				// node and its left subtree come before hi.
+				digest += avl_node_own_digest(node)
+						+ avl_node_digest(node->left);
+				node = node->right;
+			} else {
+				node = node->left;
+			}
+		}
+	}
+	return digest;
+}
+
+/**
+ * Sums the digests of the values between two keys in O(log n).
+ * @param tree Pointer to a AVL.
+ * @param lo Lower key value, exclusive, NULL for no bound.
+ * @param hi Upper key value, exclusive, NULL for no bound.
+ * @return the digest of the values between lo and hi.
+ */
+static uint64_t avl_digest_range(const avl *tree, const data *lo,
+		const data *hi) {
+	const avl_node *node = tree->root;
+	uint64_t digest = 0;
+
+	// Find the highest node between lo and hi.
+	while (node != NULL && ((lo != NULL && tree->compare(node->value, lo) >= 0)
+			|| (hi != NULL && tree->compare(node->value, hi) <= 0))) {
+
+		if (lo != NULL && tree->compare(node->value, lo) >= 0) {
+			node = node->right;
+		} else {
+			node = node->left;
+		}
+	}
+	if (node != NULL) {
+		digest = avl_node_own_digest(node)
+				+ avl_digest_after(tree, node->left, lo)
+				+ avl_digest_before(tree, node->right, hi);
+	}
+	return digest;
+}
+
+/**
+ * Reports every value of a tree between two keys as missing from the
+ * other tree.
+ * @param tree Pointer to a AVL.
+ * @param lo Lower key value, exclusive, NULL for no bound.
+ * @param hi Upper key value, exclusive, NULL for no bound.
+ * @param visit Function called with each difference.
+ * @param context Caller state passed to visit.
+ * @param count Number of differences reported.
+ * @return 1 to continue the diff, 0 if the visitor stopped it.
+ */
+static int avl_diff_rest(const avl *tree, const data *lo, const data *hi,
+		avl_diff_visitor visit, void *context, int *count) {
+	avl_cursor cursor;
+	int more = lo == NULL ?
+			avl_first(tree, &cursor) : avl_seek(tree, &cursor, lo);
+	int go = 1;
+
+	if (more && lo != NULL
+			&& tree->compare(avl_cursor_value(&cursor), lo) == 0) {
+		more = avl_next(&cursor);
+	}
+	while (go && more
+			&& (hi == NULL
+					|| tree->compare(avl_cursor_value(&cursor), hi) > 0)) {
+		(*count)++;
+		go = visit(NULL, avl_cursor_value(&cursor), context);
+		more = avl_next(&cursor);
+	}
+	return go;
+}
+
+/**
+ * Compares a subtree of target with the values of source in the same key
+ * range, skipping the comparison when their digests match.
+ * @param target Pointer to a AVL.
+ * @param node Root of a subtree of target.
+ * @param source Pointer to a AVL.
+ * @param lo Lower key value of the subtree, exclusive, NULL for no bound.
+ * @param hi Upper key value of the subtree, exclusive, NULL for no bound.
+ * @param visit Function called with each difference.
+ * @param context Caller state passed to visit.
+ * @param count Number of differences reported.
+ * @return 1 to continue the diff, 0 if the visitor stopped it.
+ */
+static int avl_diff_aux(const avl *target, const avl_node *node,
+		const avl *source, const data *lo, const data *hi,
+		avl_diff_visitor visit, void *context, int *count) {
+	int more = 1;
+
+	if (avl_node_digest(node) == avl_digest_range(source, lo, hi)) {
+		// Base case: the same values on both sides.
+		more = 1;
+	} else if (node == NULL) {
+		// Base case: source has values that target does not.
+		more = avl_diff_rest(source, lo, hi, visit, context, count);
+	} else {
+		more = avl_diff_aux(target, node->left, source, lo, node->value,
+				visit, context, count);
+
+		if (more) {
+			const avl_node *match = source->root;
+			int comp = 1;
+
+			while (match != NULL && comp != 0) {
+				comp = source->compare(match->value, node->value);
+
+				if (comp != 0) {
+					match = comp < 0 ? match->left : match->right;
+				}
+			}
+			if (match == NULL
+					|| avl_node_own_digest(match)
+							!= avl_node_own_digest(node)) {
+				// Missing from source, or stored with a different value.
+				(*count)++;
+				more = visit(node->value, match != NULL ? match->value : NULL,
+						context);
+			}
+		}
+		more = more
+				&& avl_diff_aux(target, node->right, source, node->value, hi,
+						visit, context, count);
+	}
+	return more;
+}
+
+/**
+ * Counts the values that come before key in the tree.
+ * @param tree Pointer to a AVL.
+ * @param key The key to look for.
+ * @param inclusive 1 to also count a value matching key, 0 otherwise.
+ * @return The number of values before (or matching) key.
+ */
+static int avl_rank_aux(const avl *tree, const data *key, int inclusive) {
+	const avl_node *node = tree->root;
+	int rank = 0;
+
+	while (node != NULL) {
+		int comp = tree->compare(node->value, key);
+
+		if (comp < 0) {
+			node = node->left;
+		} else if (comp > 0) {
+			// node and its left subtree come before key.
+			rank += avl_node_count(node->left) + 1;
+			node = node->right;
+		} else {
+			rank += avl_node_count(node->left) + inclusive;
+			node = NULL;
+		}
+	}
+	return rank;
+}
+
+/**
+ * Extends a cursor path from node down to the left-most or right-most node
+ * of its subtree.
+ * @param cursor Pointer to a cursor.
+ * @param node The root of the subtree to descend, may be NULL.
+ * @param left 1 to follow left children, 0 to follow right children.
+ */
+static void avl_cursor_descend(avl_cursor *cursor, const avl_node *node,
+		int left) {
+
+	while (node != NULL) {
+		assert(cursor->depth < AVL_MAX_HEIGHT);
+		cursor->path[cursor->depth++] = node;
+		node = left ? node->left : node->right;
+	}
+	return;
+}
+
+/**
+ * Extends a postorder path from node down to the first node of its subtree
+ * in postorder, preferring left children to right ones.
+ * @param path Array of AVL_MAX_HEIGHT nodes from the root down.
+ * @param depth Number of nodes on the path.
+ * @param node The root of the subtree to descend, may be NULL.
+ */
+static void avl_postorder_descend(const avl_node *path[], int *depth,
+		const avl_node *node) {
+
+	while (node != NULL) {
+		assert(*depth < AVL_MAX_HEIGHT);
+		path[(*depth)++] = node;
+		node = node->left != NULL ? node->left : node->right;
+	}
+	return;
+}
+
+/**
+ * Moves a cursor to the next value in one direction.
+ * @param cursor Pointer to a cursor on a value.
+ * @param forward 1 to move to the successor, 0 to the predecessor.
+ * @return 1 if the cursor is on a value, 0 if it moved past the end.
+ */
+static int avl_cursor_step(avl_cursor *cursor, int forward) {
+	const avl_node *node = cursor->path[cursor->depth - 1];
+	const avl_node *child = forward ? node->right : node->left;
+
+	if (child != NULL) {
+		// The next node is the nearest one in the child's subtree.
+		avl_cursor_descend(cursor, child, forward);
+	} else {
+		// Climb until we come up out of a subtree on the near side.
+		do {
+			child = cursor->path[--cursor->depth];
+		} while (cursor->depth > 0
+				&& (forward ? cursor->path[cursor->depth - 1]->right :
+						cursor->path[cursor->depth - 1]->left) == child);
+	}
+	return cursor->depth > 0;
+}
+
+/**
+ * Copies the contents of a node to an array location.
+ * @param tree Pointer to a tree.
+ * @param node Pointer to node.
+ * @param values Array of values.
+ * @param index Current index in array.
+ * @return the updated index.
+ */
+static int avl_inorder_aux(const avl *tree, const avl_node *node, data values[],
+		int index) {
+
+	if (node != NULL) {
+		index = avl_inorder_aux(tree, node->left, values, index);
+		values[index] = *node->value;
+		index++;
+		index = avl_inorder_aux(tree, node->right, values, index);
+	}
+	return index;
+}
+
+/**
+ * Copies the contents of a node to an array location.
+ * @param tree Pointer to a tree.
+ * @param node Pointer to node.
+ * @param values Array of values.
+ * @param index Current index in array.
+ * @return the updated index.
+ */
+static int avl_preorder_aux(const avl *tree, const avl_node *node,
+		data values[], int index) {
+
+	if (node != NULL) {
+		values[index] = *(node->value);
+		index++;
+		index = avl_preorder_aux(tree, node->left, values, index);
+		index = avl_preorder_aux(tree, node->right, values, index);
+	}
+	return index;
+}
+
+/**
+ * Copies the contents of a node to an array location.
+ * @param tree Pointer to a tree.
+ * @param node Pointer to node.
+ * @param values Array of values.
+ * @param index Current index in array.
+ * @return the updated index.
+ */
+static int avl_postorder_aux(const avl *tree, const avl_node *node,
+		data values[], int index) {
+
+	if (node != NULL) {
+		index = avl_postorder_aux(tree, node->left, values, index);
+		index = avl_postorder_aux(tree, node->right, values, index);
+		values[index] = *(node->value);
+		index++;
+	}
+	return index;
+}
+/**
+ * Returns the number of leaves (nodes with no children) in node.
+ * @param node The node to process.
+ * @return The number of leaves for node and its children.
+ */
+static int avl_leaf_count_aux(const avl_node *node) {
+	int count = 0;
+
+	if (node == NULL) {
+		// Base case: no node.
+		count = 0;
+	} else if (node->left == NULL && node->right == NULL) {
+		// Base case: node has no children.
+		count = 1;
+	} else {
+		count = avl_leaf_count_aux(node->left)
+				+ avl_leaf_count_aux(node->right);
+	}
+	return count;
+}
+
+/**
+ * Returns the number of one child nodes in a AVL node.
+ * @param node The node to process.
+ * @return The number of one child nodes for node and its children.
+ */
+static int avl_one_child_count_aux(const avl_node *node) {
+	int count = 0;
+
+	if (node == NULL) {
+		// Base case: empty node..
+		count = 0;
+	} else if (node->left == NULL && node->right != NULL) {
+		// General case: node has one child.
+		count = 1 + avl_one_child_count_aux(node->right);
+	} else if (node->left != NULL && node->right == NULL) {
+		// General case: node has one child.
+		count = 1 + avl_one_child_count_aux(node->left);
+	} else {
+		// General case: node has two children.
+		count = avl_one_child_count_aux(node->left)
+				+ avl_one_child_count_aux(node->right);
+	}
+	return count;
+}
+
+/**
+ * Returns the number of types of nodes in a AVL node.
+ * @param node The node to process.
+ * @return The number of two children nodes for node and its children.
+ */
+static int avl_two_child_count_aux(const avl_node *node) {
+	int count = 0;
+
+	if (node == NULL) {
+		// Base case: no node.
+		count = 0;
+	} else if (node->left != NULL && node->right != NULL) {
+		// General case: node has two children.
+		count = 1 + avl_two_child_count_aux(node->left)
+				+ avl_two_child_count_aux(node->right);
+	} else {
+		// General case: node has one child.
+		count = avl_two_child_count_aux(node->left)
+				+ avl_two_child_count_aux(node->right);
+	}
+	return count;
+}
+
+/**
+ * Determines the number of zero, one, and two children nodes in a tree.
+ * @param node The node to process.
+ * @param zero The number of zero children nodes for node and its children.
+ * @param one The number of one child nodes for node and its children.
+ * @param two The number of two children nodes for node and its children.
+ */
+static void avl_node_counts_aux(const avl_node *node, int *zero, int *one,
+		int *two) {
+
+	if (node != NULL) {
+
+		if (node->left == NULL && node->right == NULL) {
+			// Base case: leaf node
+			(*zero)++;
+		} else if (node->left == NULL && node->right != NULL) {
+			// One child - right
+			(*one)++;
+			avl_node_counts_aux(node->right, zero, one, two);
+		} else if (node->left != NULL && node->right == NULL) {
+			// One child - left
+			(*one)++;
+			avl_node_counts_aux(node->left, zero, one, two);
+		} else {
+			// two children
+			(*two)++;
+			avl_node_counts_aux(node->left, zero, one, two);
+			avl_node_counts_aux(node->right, zero, one, two);
+		}
+	}
+	return;
+}
+
+/**
+ * Determines whether the stored height of a node follows the rules of its
+ * tree, given the stored heights of its children.
+ * @param tree Pointer to a AVL.
+ * @param node The node to process.
+ * @return 1 if the node's height is correct, 0 otherwise.
+ */
+static int avl_node_balanced(const avl *tree, const avl_node *node) {
+	int left = node->height - avl_node_height(node->left);
+	int right = node->height - avl_node_height(node->right);
+	int balanced = 0;
+
+	if (tree->balance == AVL_BALANCE_WEAK) {
+		// Each child one or two ranks down, and every leaf at rank 0.
+		balanced = left >= 1 && left <= 2 && right >= 1 && right <= 2
+				&& (node->height == 1 || node->left != NULL
+						|| node->right != NULL);
+	} else {
+		// One child one level down, the other at most two.
+		balanced = (left == 1 && (right == 1 || right == 2))
+				|| (left == 2 && right == 1);
+	}
+	return balanced;
+}
+
+/**
+ * Determines whether the AVL is balanced.
+ * @param tree Pointer to a AVL.
+ * @param node The node to process.
+ * @return 1 if the node and its children are balanced, 0 otherwise.
+ */
+static int avl_balanced_aux(const avl *tree, const avl_node *node) {
+	int balanced = 0;
+
+	if (node == NULL) {
+		// Base case: no node.
+		balanced = 1;
+	} else if (!avl_node_balanced(tree, node)) {
+		// Base case: left or right subtree is too deep.
+		balanced = 0;
+	} else {
+		// General case: check the children of node.
+		balanced = avl_balanced_aux(tree, node->left)
+				&& avl_balanced_aux(tree, node->right);
+	}
+	return balanced;
+}
+
+/**
+ * Determines if a tree is a valid AVL.
+ * @param tree pointer to a tree.
+ * @param node The node to process.
+ * @return 1 if the node and its children are valid, 0 otherwise.
+ */
+static int avl_valid_aux(const avl *tree, const avl_node *node,
+		const avl_node *min_node, const avl_node *max_node) {
+	int valid = 0;
+
+	if (node == NULL) {
+		// Base case: no node
+		valid = 1;
+	} else if (min_node != NULL
+			&& tree->LESS_THAN_EQUAL(min_node->value, node->value)) {
+		// Base case: node value less = than min_node value
+		valid = 0;
+	} else if (max_node != NULL
+			&& tree->GREATER_THAN_EQUAL(max_node->value, node->value)) {
+		// Base case: node value greater = max_node value
 		valid = 0;
-	} else if (MAX_HEIGHT(avl_node_height(node->left),
-			avl_node_height(node->right)) != (node->height - 1)) {
-		// Base case: node heights are incorrect
+	} else if (!avl_node_balanced(tree, node)) {
+		// Base case: height violation - node heights incorrect or child
+		// heights not balanced
 		valid = 0;
+	} else if (avl_node_count(node->left) + avl_node_count(node->right)
+			!= (node->count - 1)) {
+		// Base case: subtree sizes are incorrect
+		valid = 0;
+	} else {
+		valid = avl_valid_aux(tree, node->left, min_node, node)
+				&& avl_valid_aux(tree, node->right, node, max_node);
+	}
+	return valid;
+}
+
+/**
+ * Determines if two trees are identical.
+ * @param node1 Pointer to an AVL node.
+ * @param node2 Pointer to an AVL node.
+ * @return 1 if trees are identical, 0 otherwise.
+ */
+static int avl_equals_aux(const avl *tree, const avl_node *target,
+		const avl_node *source) {
+	int equals = 0;
+
+	if (target == NULL && source == NULL) {
+		// Base case: Trees are identical so far.
+		equals = 1;
+	} else if ((target == NULL && source != NULL)
+			|| (target != NULL && source == NULL)
+			|| tree->compare(target->value, source->value) != 0) {
+		// Base case: tree elements are not equal.
+		equals = 0;
 	} else {
-		valid = avl_valid_aux(tree, node->left, min_node, node)
-				&& avl_valid_aux(tree, node->right, node, max_node);
+		// General case: search rest of trees.
+		equals = avl_equals_aux(tree, target->left, source->left)
+				&& avl_equals_aux(tree, target->right, source->right);
+	}
+	return equals;
+}
+
+//--------------------------------------------------------------------
+// Functions
+
+avl* avl_initialize(data_destroy destroy, data_copy copy,
+		data_to_string to_string, data_compare compare) {
+	avl *tree = malloc(sizeof *tree);
+	assert(tree != NULL);
+
+	tree->root = NULL;
+	tree->pool = NULL;
+	tree->sync = NULL;
+	tree->hash = NULL;
+	tree->balance = AVL_BALANCE_STRICT;
+	tree->changes = 0;
+	tree->size = 0;
+#ifdef AVL_STATS
+	memset(&tree->counters, 0, sizeof tree->counters);
+#endif
+	tree->destroy = destroy;
+	tree->copy = copy;
+	tree->to_string = to_string;
+	tree->compare = compare;
+	return tree;
+}
+
+void avl_enable_pool(avl *tree, int chunk_size) {
+	assert(tree->root == NULL && tree->pool == NULL);
+	assert(chunk_size > 0);
+
+	tree->pool = avl_pool_initialize(chunk_size, avl_node_size(tree));
+	return;
+}
+
+void avl_set_balance(avl *tree, avl_balance balance) {
+	assert(tree->root == NULL);
+
+	tree->balance = balance;
+	return;
+}
+
+void avl_enable_concurrency(avl *tree) {
+	assert(tree->sync == NULL);
+	avl_sync *sync = malloc(sizeof *sync);
+	assert(sync != NULL);
+
+	pthread_mutex_init(&sync->writer, NULL);
+	atomic_init(&sync->version, 0);
+	atomic_init(&sync->epoch, 0);
+	atomic_init(&sync->readers[0], 0);
+	atomic_init(&sync->readers[1], 0);
+	sync->retired = NULL;
+	sync->retired_count = 0;
+	sync->retired_capacity = 0;
+	tree->sync = sync;
+	return;
+}
+
+avl* avl_snapshot(avl *tree) {
+	assert(tree->sync == NULL);
+	avl *snapshot = malloc(sizeof *snapshot);
+	assert(snapshot != NULL);
+
+	// The snapshot shares the whole tree, nodes and allocator alike.
+	*snapshot = *tree;
+	// The tree's nodes are now shared, so a change copies its path.
+	tree->changes++;
+
+	if (tree->root != NULL) {
+		tree->root->refs++;
+	}
+	if (tree->pool != NULL) {
+		tree->pool->refs++;
+	}
+	return snapshot;
+}
+
+void avl_destroy(avl **tree) {
+
+	if ((*tree)->sync != NULL) {
+		// No readers are left, so retired nodes can go immediately.
+		avl_sync_release(*tree);
+		pthread_mutex_destroy(&(*tree)->sync->writer);
+		free((*tree)->sync->retired);
+		free((*tree)->sync);
+		(*tree)->sync = NULL;
+	}
+	if ((*tree)->pool != NULL && (*tree)->pool->refs == 1) {
+		// Every node left in the pool belongs to this tree.
+		avl_pool_destroy(*tree);
+	} else {
+		avl_destroy_aux(*tree, &(*tree)->root);
+
+		if ((*tree)->pool != NULL) {
+			// Snapshots still allocate from the pool.
+			(*tree)->pool->refs--;
+		}
+	}
+	free(*tree);
+	*tree = NULL;
+	return;
+}
+
+int avl_empty(const avl *tree) {
+	return tree->root == NULL;
+}
+
+int avl_full(const avl *tree) {
+	return 0;
+}
+
+int avl_size(const avl *tree) {
+	return tree->size;
+}
+
+void avl_inorder(const avl *tree, data *values) {
+	avl_lock(tree);
+	avl_inorder_aux(tree, tree->root, values, 0);
+	avl_unlock(tree);
+	return;
+}
+
+void avl_preorder(const avl *tree, data *values) {
+	avl_lock(tree);
+	avl_preorder_aux(tree, tree->root, values, 0);
+	avl_unlock(tree);
+	return;
+}
+
+void avl_postorder(const avl *tree, data *values) {
+	avl_lock(tree);
+	avl_postorder_aux(tree, tree->root, values, 0);
+	avl_unlock(tree);
+	return;
+}
+
+int avl_foreach_inorder(const avl *tree, avl_visitor visit, void *context) {
+	avl_cursor cursor;
+	int count = 0;
+	int more = 0;
+
+	avl_lock(tree);
+	more = avl_first(tree, &cursor);
+
+	while (more) {
+		count++;
+		more = visit(avl_cursor_value(&cursor), context)
+				&& avl_next(&cursor);
+	}
+	avl_unlock(tree);
+	return count;
+}
+
+int avl_foreach_preorder(const avl *tree, avl_visitor visit, void *context) {
+	// Right children still to visit - at most one per level.
+	const avl_node *pending[AVL_MAX_HEIGHT];
+	const avl_node *node = NULL;
+	int depth = 0;
+	int count = 0;
+	int more = 1;
+
+	avl_lock(tree);
+	node = tree->root;
+
+	while (more && node != NULL) {
+		count++;
+		more = visit(node->value, context);
+
+		if (node->left != NULL) {
+
+			if (node->right != NULL) {
+				assert(depth < AVL_MAX_HEIGHT);
+				pending[depth++] = node->right;
+			}
+			node = node->left;
+		} else if (node->right != NULL) {
+			node = node->right;
+		} else {
+			node = depth > 0 ? pending[--depth] : NULL;
+		}
+	}
+	avl_unlock(tree);
+	return count;
+}
+
+int avl_foreach_postorder(const avl *tree, avl_visitor visit, void *context) {
+	const avl_node *path[AVL_MAX_HEIGHT];
+	int depth = 0;
+	int count = 0;
+	int more = 1;
+
+	avl_lock(tree);
+	avl_postorder_descend(path, &depth, tree->root);
+
+	while (more && depth > 0) {
+		const avl_node *node = path[--depth];
+
+		count++;
+		more = visit(node->value, context);
+
+		if (depth > 0 && path[depth - 1]->left == node) {
+			// Done with a left subtree - its right sibling comes next.
+			avl_postorder_descend(path, &depth, path[depth - 1]->right);
+		}
+	}
+	avl_unlock(tree);
+	return count;
+}
+
+int avl_insert(avl *tree, const data *value) {
+	avl_node **path[AVL_MAX_HEIGHT];
+	int depth = 0;
+	int inserted = 0;
+	avl_node **link = NULL;
+
+	avl_write_begin(tree);
+	AVL_COUNT(tree, inserts, 1);
+	link = avl_search_path(tree, value, path, &depth);
+
+	if (*link == NULL) {
+		// Add a new node containing the value and rebalance its ancestors.
+		avl_path_own(tree, path, depth);
+		link = path[depth];
+		AVL_STORE(*link, avl_node_initialize(tree, value));
+		avl_path_grow(tree, path, depth);
+		tree->size += 1;
+		avl_retrace(tree, path, depth - 1);
+		inserted = 1;
+	}
+	avl_write_end(tree);
+	return inserted;
+}
+
+int avl_insert_hint(avl *tree, avl_cursor *hint, const data *value) {
+	avl_node **path[AVL_MAX_HEIGHT];
+	int depth = 0;
+	int inserted = 0;
+	int top = 0;
+	avl_node **link = NULL;
+	const avl_node *node = NULL;
+
+	avl_write_begin(tree);
+	AVL_COUNT(tree, inserts, 1);
+	depth = avl_finger_depth(tree, hint, value);
+	path[0] = &tree->root;
+
+	// Turn the nodes kept from the hint into links.
+	for (int i = 1; i < depth; i++) {
+		avl_node *parent = (avl_node*) hint->path[i - 1];
+
+		path[i] = parent->left == hint->path[i] ?
+				&parent->left : &parent->right;
+	}
+	depth = depth > 0 ? depth - 1 : 0;
+	link = avl_search_below(tree, value, path, &depth);
+	top = depth;
+
+	if (*link == NULL) {
+		// Add a new node containing the value and rebalance its ancestors.
+		avl_path_own(tree, path, depth);
+		link = path[depth];
+		AVL_STORE(*link, avl_node_initialize(tree, value));
+		avl_path_grow(tree, path, depth);
+		tree->size += 1;
+		top = avl_retrace(tree, path, depth - 1);
+		inserted = 1;
+	}
+	// Only the nodes from top down can have moved: keep the ones above and
+	// search again below them.
+	hint->tree = tree;
+	// The hint stays usable after the change avl_write_end counts below.
+	hint->changes = tree->changes + 1;
+	hint->depth = 0;
+
+	while (hint->depth < top) {
+		hint->path[hint->depth] = *path[hint->depth];
+		hint->depth++;
+	}
+	node = *path[top];
+
+	while (node != NULL) {
+		int comp = tree->compare(node->value, value);
+
+		AVL_COUNT(tree, compares, 1);
+		assert(hint->depth < AVL_MAX_HEIGHT);
+		hint->path[hint->depth++] = node;
+
+		if (comp < 0) {
+			node = node->left;
+		} else if (comp > 0) {
+			node = node->right;
+		} else {
+			node = NULL;
+		}
+	}
+	avl_write_end(tree);
+	return inserted;
+}
+
+int avl_upsert(avl *tree, const data *value, data_merge merge) {
+	avl_node **path[AVL_MAX_HEIGHT];
+	int depth = 0;
+	int inserted = 0;
+	avl_node **link = NULL;
+
+	avl_write_begin(tree);
+	AVL_COUNT(tree, inserts, 1);
+	link = avl_search_path(tree, value, path, &depth);
+	// Inserting or changing a value both need the path to be this tree's.
+	avl_path_own(tree, path, depth);
+	link = path[depth];
+
+	if (*link == NULL) {
+		// Add a new node containing the value and rebalance its ancestors.
+		AVL_STORE(*link, avl_node_initialize(tree, value));
+		avl_path_grow(tree, path, depth);
+		tree->size += 1;
+		avl_retrace(tree, path, depth - 1);
+		inserted = 1;
+	} else {
+		avl_node *node = *link;
+		uint64_t old = tree->hash != NULL ? avl_node_own_digest(node) : 0;
+
+		if (tree->sync == NULL) {
+
+			if (merge != NULL) {
+				merge(node->value, value);
+			} else {
+				tree->destroy(&node->value);
+				AVL_COUNT(tree, destroys, 1);
+				node->value = tree->copy(value);
+				AVL_COUNT(tree, copies, 1);
+			}
+		} else {
+			// Readers may be copying the stored value: change a copy, and
+			// retire the old value in an empty node until they are done.
+			data *fresh = tree->copy(merge != NULL ? node->value : value);
+			avl_node *shell = avl_node_alloc(tree);
+
+			AVL_COUNT(tree, copies, 1);
+
+			if (merge != NULL) {
+				merge(fresh, value);
+			}
+			shell->value = node->value;
+			shell->left = NULL;
+			shell->right = NULL;
+			AVL_STORE(node->value, fresh);
+			avl_node_discard(tree, shell);
+		}
+		if (tree->hash != NULL) {
+			// The value's part of every digest on the path has changed.
+			avl_path_digest(tree, path, 0, depth,
+					avl_mix(tree->hash(node->value)) - old);
+		}
+	}
+	avl_write_end(tree);
+	return inserted;
+}
+
+data* avl_get_or_insert(avl *tree, const data *key, data_factory factory) {
+	avl_node **path[AVL_MAX_HEIGHT];
+	int depth = 0;
+	avl_node **link = NULL;
+	data *value = NULL;
+
+	avl_write_begin(tree);
+	AVL_COUNT(tree, inserts, 1);
+	link = avl_search_path(tree, key, path, &depth);
+	// The caller may change the value, so it must not be a snapshot's.
+	avl_path_own(tree, path, depth);
+	link = path[depth];
+
+	if (*link == NULL) {
+
+		if (factory != NULL) {
+			value = factory(key);
+		} else {
+			value = tree->copy(key);
+			AVL_COUNT(tree, copies, 1);
+		}
+		assert(tree->compare(value, key) == 0);
+		AVL_STORE(*link, avl_node_adopt(tree, value));
+		avl_path_grow(tree, path, depth);
+		tree->size += 1;
+		avl_retrace(tree, path, depth - 1);
+	} else {
+		value = (*link)->value;
+	}
+	avl_write_end(tree);
+	return value;
+}
+
+void avl_build_sorted(avl *tree, const data *values, int n) {
+	avl_array_source source = { values, 0 };
+
+	avl_build_stream(tree, avl_array_next, &source, n);
+	return;
+}
+
+void avl_build_stream(avl *tree, avl_source next, void *context, int n) {
+	assert(tree->root == NULL);
+
+	avl_write_begin(tree);
+	AVL_STORE(tree->root, avl_build_aux(tree, next, context, n));
+	tree->size = n;
+	assert(avl_valid_aux(tree, tree->root, NULL, NULL));
+	avl_write_end(tree);
+	return;
+}
+
+int avl_insert_batch(avl *tree, const data *values, int n, int nthreads) {
+	int inserted = 0;
+
+	if (n > 0) {
+		const data **keys = malloc(n * sizeof *keys);
+		const data **temp = malloc(n * sizeof *temp);
+		assert(keys != NULL && temp != NULL);
+		int m = 0;
+
+		if (nthreads > n / AVL_BATCH_GRAIN + 1) {
+			nthreads = n / AVL_BATCH_GRAIN + 1;
+		}
+		if (nthreads < 1) {
+			nthreads = 1;
+		}
+		for (int i = 0; i < n; i++) {
+			keys[i] = &values[i];
+		}
+		avl_batch_sort(tree, keys, temp, n, nthreads);
+
+		// Keep the first of equal values, as inserting in batch order would.
+		for (int i = 0; i < n; i++) {
+			if (m == 0 || tree->compare(keys[m - 1], keys[i]) != 0) {
+				keys[m++] = keys[i];
+			}
+		}
+		if (nthreads == 1 || tree->sync != NULL
+				|| (tree->pool != NULL && tree->pool->refs > 1)) {
+			// Readers, or nodes shared with a snapshot, rule out splitting.
+			for (int i = 0; i < m; i++) {
+				inserted += avl_insert(tree, keys[i]);
+			}
+		} else {
+			tree->changes++;
+			inserted = avl_batch_insert(tree, keys, m, nthreads);
+		}
+		free(keys);
+		free(temp);
+	}
+	return inserted;
+}
+
+const data* avl_find(const avl *tree, const data *key) {
+	const avl_node *node = tree->root;
+	const data *value = NULL;
+
+	AVL_COUNT(tree, lookups, 1);
+
+	while (node != NULL && value == NULL) {
+		int comp = tree->compare(node->value, key);
+
+		AVL_COUNT(tree, compares, 1);
+		AVL_COUNT(tree, path_length, 1);
+
+		if (comp < 0) {
+			node = node->left;
+		} else if (comp > 0) {
+			node = node->right;
+		} else {
+			value = node->value;
+		}
+	}
+	return value;
+}
+
+const data* avl_find_near(const avl *tree, avl_cursor *finger,
+		const data *key) {
+	int keep = avl_finger_depth(tree, finger, key);
+	const avl_node *node = tree->root;
+	const data *value = NULL;
+	// Path length up to the last node found that is not less than key.
+	int found = 0;
+
+	AVL_COUNT(tree, lookups, 1);
+	finger->tree = tree;
+	finger->changes = tree->changes;
+	finger->depth = 0;
+
+	if (keep > 0) {
+		// Continue below the kept path. Until something in that subtree is
+		// not less than key, the lower bound is the nearest ancestor the
+		// path leaves to the left.
+		finger->depth = keep - 1;
+		node = finger->path[keep - 1];
+
+		for (int i = keep - 1; i > 0 && found == 0; i--) {
+
+			if (finger->path[i - 1]->left == finger->path[i]) {
+				found = i;
+			}
+		}
+	}
+	while (node != NULL) {
+		int comp = tree->compare(node->value, key);
+
+		AVL_COUNT(tree, compares, 1);
+		AVL_COUNT(tree, path_length, 1);
+		assert(finger->depth < AVL_MAX_HEIGHT);
+		finger->path[finger->depth++] = node;
+
+		if (comp < 0) {
+			found = finger->depth;
+			node = node->left;
+		} else if (comp > 0) {
+			node = node->right;
+		} else {
+			found = finger->depth;
+			value = node->value;
+			node = NULL;
+		}
+	}
+	// Drop the nodes below the lower bound from the path.
+	finger->depth = found;
+	return value;
+}
+
+data* avl_retrieve(const avl *tree, const data *key) {
+	data *value = NULL;
+
+	if (tree->sync == NULL) {
+		const data *found = avl_find(tree, key);
+
+		if (found != NULL) {
+			value = tree->copy(found);
+			AVL_COUNT(tree, copies, 1);
+		}
+	} else {
+		// Copy the value before its node can be reclaimed.
+		int slot = avl_read_enter(tree->sync);
+		const avl_node *node = avl_search_shared(tree, key);
+
+		if (node != NULL) {
+			value = tree->copy(AVL_LOAD(node->value));
+			AVL_COUNT(tree, copies, 1);
+		}
+		avl_read_exit(tree->sync, slot);
 	}
-	return valid;
+	return value;
 }
 
-/**
- * Determines if two trees are identical.
- * @param node1 Pointer to an AVL node.
- * @param node2 Pointer to an AVL node.
- * @return 1 if trees are identical, 0 otherwise.
- */
-static int avl_equals_aux(const avl *tree, const avl_node *target,
-		const avl_node *source) {
-	int equals = 0;
+int avl_retrieve_many(const avl *tree, const data keys[], int n,
+		const data *values[]) {
+	int found = 0;
 
-	if (target == NULL && source == NULL) {
-		// Base case: Trees are identical so far.
-		equals = 1;
-	} else if ((target == NULL && source != NULL)
-			|| (target != NULL && source == NULL)
-			|| tree->compare(target->value, source->value) == 0) {
-		// Base case: tree elements are not equal.
-		equals = 0;
+	AVL_COUNT(tree, lookups, n);
+
+	for (int first = 0; first < n; first += AVL_GROUP) {
+		const avl_node *nodes[AVL_GROUP];
+		int count = n - first < AVL_GROUP ? n - first : AVL_GROUP;
+		int active = count;
+
+		for (int j = 0; j < count; j++) {
+			nodes[j] = tree->root;
+			values[first + j] = NULL;
+
+			if (nodes[j] == NULL) {
+				active--;
+			}
+		}
+		while (active > 0) {
+			// Start loading every value to be compared before comparing any.
+			for (int j = 0; j < count; j++) {
+
+				if (nodes[j] != NULL) {
+					__builtin_prefetch(nodes[j]->value);
+				}
+			}
+			// Take one step of each search, and start loading the next nodes.
+			for (int j = 0; j < count; j++) {
+				const avl_node *node = nodes[j];
+
+				if (node != NULL) {
+					int comp = tree->compare(node->value, &keys[first + j]);
+
+					AVL_COUNT(tree, compares, 1);
+					AVL_COUNT(tree, path_length, 1);
+
+					if (comp < 0) {
+						node = node->left;
+					} else if (comp > 0) {
+						node = node->right;
+					} else {
+						values[first + j] = node->value;
+						found++;
+						node = NULL;
+					}
+					if (node != NULL) {
+						__builtin_prefetch(node);
+					} else {
+						active--;
+					}
+					nodes[j] = node;
+				}
+			}
+		}
+	}
+	return found;
+}
+
+int avl_retrieve_into(const avl *tree, const data *key, data *value) {
+	int found = 0;
+
+	if (tree->sync == NULL) {
+		const data *stored = avl_find(tree, key);
+
+		if (stored != NULL) {
+			*value = *stored;
+			found = 1;
+		}
 	} else {
-		// General case: search rest of trees.
-		equals = avl_equals_aux(tree, target->left, source->left)
-				&& avl_equals_aux(tree, target->right, source->right);
+		int slot = avl_read_enter(tree->sync);
+		const avl_node *node = avl_search_shared(tree, key);
+
+		if (node != NULL) {
+			*value = *AVL_LOAD(node->value);
+			found = 1;
+		}
+		avl_read_exit(tree->sync, slot);
 	}
-	return equals;
+	return found;
 }
 
-//--------------------------------------------------------------------
-// Functions
+data* avl_select(const avl *tree, int k) {
+	const avl_node *node = NULL;
+	data *value = NULL;
 
-avl* avl_initialize(data_destroy destroy, data_copy copy,
-		data_to_string to_string, data_compare compare) {
-	avl *tree = malloc(sizeof *tree);
-	assert(tree != NULL);
+	avl_lock(tree);
+	node = tree->root;
 
-	tree->root = NULL;
-	tree->size = 0;
-	tree->destroy = destroy;
-	tree->copy = copy;
-	tree->to_string = to_string;
-	tree->compare = compare;
-	return tree;
+	if (k >= 0 && k < tree->size) {
+
+		while (value == NULL) {
+			int left_count = avl_node_count(node->left);
+
+			if (k < left_count) {
+				node = node->left;
+			} else if (k > left_count) {
+				k -= left_count + 1;
+				node = node->right;
+			} else {
+				value = tree->copy(node->value);
+				AVL_COUNT(tree, copies, 1);
+			}
+		}
+	}
+	avl_unlock(tree);
+	return value;
 }
 
-void avl_destroy(avl **tree) {
-	avl_destroy_aux(*tree, &(*tree)->root);
-	free(*tree);
-	*tree = NULL;
-	return;
+int avl_rank(const avl *tree, const data *key) {
+	avl_lock(tree);
+	int rank = avl_rank_aux(tree, key, 0);
+	avl_unlock(tree);
+	return rank;
 }
 
-int avl_empty(const avl *tree) {
-	return tree->root == NULL;
+int avl_count_range(const avl *tree, const data *lo, const data *hi) {
+	int count = 0;
+
+	if (tree->compare(lo, hi) >= 0) {
+		// lo does not come after hi.
+		avl_lock(tree);
+		count = avl_rank_aux(tree, hi, 1) - avl_rank_aux(tree, lo, 0);
+		avl_unlock(tree);
+	}
+	return count;
 }
 
-int avl_full(const avl *tree) {
-	return 0;
+void avl_join(avl *target, avl *source) {
+	assert(target->root == NULL || source->root == NULL
+			|| target->compare(avl_find_max(target), avl_find_min(source)) > 0);
+	avl_node *root = avl_take(target, source);
+
+	target->root = avl_join2(target, target->root, root);
+	target->size = avl_node_count(target->root);
+	return;
 }
 
-int avl_size(const avl *tree) {
-	return tree->size;
+avl* avl_split(avl *tree, const data *key) {
+	assert(tree->sync == NULL);
+	avl *right = malloc(sizeof *right);
+	assert(right != NULL);
+	avl_node *left = NULL;
+	avl_node *found = NULL;
+
+	// The new tree shares the allocator the nodes came from.
+	*right = *tree;
+	right->root = NULL;
+
+	if (tree->pool != NULL) {
+		tree->pool->refs++;
+	}
+	tree->changes++;
+	found = avl_split_aux(tree, tree->root, key, &left, &right->root);
+
+	if (found != NULL) {
+		right->root = avl_join_aux(tree, NULL, found, right->root);
+	}
+	tree->root = left;
+	tree->size = avl_node_count(left);
+	right->size = avl_node_count(right->root);
+	return right;
 }
 
-void avl_inorder(const avl *tree, data *values) {
-	avl_inorder_aux(tree, tree->root, values, 0);
+void avl_union(avl *target, avl *source) {
+	avl_node *root = avl_take(target, source);
+
+	target->root = avl_union_aux(target, target->root, root);
+	target->size = avl_node_count(target->root);
 	return;
 }
 
-void avl_preorder(const avl *tree, data *values) {
-	avl_preorder_aux(tree, tree->root, values, 0);
+void avl_intersection(avl *target, avl *source) {
+	avl_node *root = avl_take(target, source);
+
+	target->root = avl_intersection_aux(target, target->root, root);
+	target->size = avl_node_count(target->root);
 	return;
 }
 
-void avl_postorder(const avl *tree, data *values) {
-	avl_postorder_aux(tree, tree->root, values, 0);
+void avl_difference(avl *target, avl *source) {
+	avl_node *root = avl_take(target, source);
+
+	target->root = avl_difference_aux(target, target->root, root);
+	target->size = avl_node_count(target->root);
 	return;
 }
 
-int avl_insert(avl *tree, const data *value) {
-	return avl_insert_aux(tree, &(tree->root), value);
+int avl_remove_range(avl *tree, const data *lo, const data *hi) {
+	avl_node *left = NULL;
+	avl_node *middle = NULL;
+	avl_node *right = NULL;
+	avl_node *found = NULL;
+	int count = 0;
+
+	if (tree->compare(lo, hi) >= 0) {
+		avl_write_begin(tree);
+		// Cut off the values before lo, then the values after hi.
+		found = avl_split_aux(tree, tree->root, lo, &left, &right);
+
+		if (found != NULL) {
+			right = avl_join_aux(tree, NULL, found, right);
+		}
+		found = avl_split_aux(tree, right, hi, &middle, &right);
+
+		if (found != NULL) {
+			middle = avl_join_aux(tree, middle, found, NULL);
+		}
+		AVL_STORE(tree->root, avl_join2(tree, left, right));
+		count = avl_node_count(middle);
+		tree->size -= count;
+		avl_discard_aux(tree, middle);
+		avl_write_end(tree);
+	}
+	return count;
 }
 
-data* avl_retrieve(const avl *tree, const data *key) {
-	avl_node *node = tree->root;
+data* avl_remove(avl *tree, const data *key) {
+	avl_node **path[AVL_MAX_HEIGHT];
+	int depth = 0;
 	data *value = NULL;
+	avl_node **link = NULL;
 
-	while (node != NULL && value == NULL) {
+	avl_write_begin(tree);
+	AVL_COUNT(tree, removes, 1);
+	link = avl_search_path(tree, key, path, &depth);
+
+	if (*link != NULL) {
+		avl_path_own(tree, path, depth);
+		avl_node *target = avl_unlink(tree, path, depth);
+
+		if (tree->sync == NULL) {
+			value = target->value;
+			avl_node_release(tree, target);
+		} else {
+			// Readers may still be comparing against the stored value.
+			value = tree->copy(target->value);
+			AVL_COUNT(tree, copies, 1);
+			avl_node_discard(tree, target);
+		}
+	}
+	avl_write_end(tree);
+	return value;
+}
+
+int avl_seek(const avl *tree, avl_cursor *cursor, const data *key) {
+	const avl_node *node = tree->root;
+	// Path length up to the last node found that is not less than key.
+	int found = 0;
+
+	cursor->tree = tree;
+	cursor->changes = tree->changes;
+	cursor->depth = 0;
+
+	while (node != NULL) {
 		int comp = tree->compare(node->value, key);
 
+		assert(cursor->depth < AVL_MAX_HEIGHT);
+		cursor->path[cursor->depth++] = node;
+
 		if (comp < 0) {
+			found = cursor->depth;
 			node = node->left;
 		} else if (comp > 0) {
 			node = node->right;
 		} else {
-			value = tree->copy(node->value);
+			found = cursor->depth;
+			node = NULL;
 		}
 	}
+	// Drop the nodes below the lower bound from the path.
+	cursor->depth = found;
+	return cursor->depth > 0;
+}
+
+int avl_first(const avl *tree, avl_cursor *cursor) {
+	cursor->tree = tree;
+	cursor->changes = tree->changes;
+	cursor->depth = 0;
+	avl_cursor_descend(cursor, tree->root, 1);
+	return cursor->depth > 0;
+}
+
+int avl_last(const avl *tree, avl_cursor *cursor) {
+	cursor->tree = tree;
+	cursor->changes = tree->changes;
+	cursor->depth = 0;
+	avl_cursor_descend(cursor, tree->root, 0);
+	return cursor->depth > 0;
+}
+
+int avl_next(avl_cursor *cursor) {
+	assert(cursor->depth > 0);
+	return avl_cursor_step(cursor, 1);
+}
+
+int avl_prev(avl_cursor *cursor) {
+	assert(cursor->depth > 0);
+	return avl_cursor_step(cursor, 0);
+}
+
+const data* avl_cursor_value(const avl_cursor *cursor) {
+	const data *value = NULL;
+
+	if (cursor->depth > 0) {
+		value = cursor->path[cursor->depth - 1]->value;
+	}
 	return value;
 }
 
-data* avl_remove(avl *tree, const data *key) {
-	return avl_remove_aux(tree, &(tree->root), key);
+int avl_range(const avl *tree, const data *lo, const data *hi,
+		avl_visitor visit, void *context) {
+	avl_cursor cursor;
+	int count = 0;
+	int more = 0;
+
+	avl_lock(tree);
+	more = avl_seek(tree, &cursor, lo);
+
+	// Stop at the first value past hi, or when the visitor asks to.
+	while (more && tree->compare(avl_cursor_value(&cursor), hi) >= 0) {
+		count++;
+		more = visit(avl_cursor_value(&cursor), context)
+				&& avl_next(&cursor);
+	}
+	avl_unlock(tree);
+	return count;
 }
 
-data* avl_max(const avl *tree) {
-	assert(tree->root != NULL);
+const data* avl_find_max(const avl *tree) {
+	const data *value = NULL;
 
-	// Find the node containing the largest data.
-	// (It is the right-most node.)
-	avl_node *node = tree->root;
+	if (tree->root != NULL) {
+		// Find the node containing the largest data.
+		// (It is the right-most node.)
+		const avl_node *node = tree->root;
 
-	while (node->right != NULL) {
-		node = node->right;
+		while (node->right != NULL) {
+			node = node->right;
+		}
+		value = node->value;
 	}
-	return tree->copy(node->value);
+	return value;
 }
 
-data* avl_min(const avl *tree) {
-	assert(tree->root != NULL);
+const data* avl_find_min(const avl *tree) {
+	const data *value = NULL;
+
+	if (tree->root != NULL) {
+		// Find the node containing the smallest data.
+		// (It is the left-most node.)
+		const avl_node *node = tree->root;
+
+		while (node->left != NULL) {
+			node = node->left;
+		}
+		value = node->value;
+	}
+	return value;
+}
+
+/**
+ * Copies the left-most or right-most value, searching optimistically if
+ * the tree is shared.
+ * @param tree Pointer to a tree.
+ * @param left 1 for the minimum value, 0 for the maximum value.
+ * @return Copy of the value.
+ */
+static data* avl_extreme(const avl *tree, int left) {
+	data *value = NULL;
 
-	// Find the node containing the largest data.
-	// (It is the right-most node.)
-	avl_node *node = tree->root;
+	if (tree->sync == NULL) {
+		assert(tree->root != NULL);
+		value = tree->copy(left ? avl_find_min(tree) : avl_find_max(tree));
+	} else {
+		int slot = avl_read_enter(tree->sync);
+		const avl_node *node = avl_extreme_shared(tree, left);
+		assert(node != NULL);
 
-	while (node->left != NULL) {
-		node = node->left;
+		value = tree->copy(AVL_LOAD(node->value));
+		avl_read_exit(tree->sync, slot);
 	}
-	return tree->copy(node->value);
+	AVL_COUNT(tree, copies, 1);
+	return value;
+}
+
+data* avl_max(const avl *tree) {
+	return avl_extreme(tree, 0);
+}
+
+data* avl_min(const avl *tree) {
+	return avl_extreme(tree, 1);
 }
 
 void avl_node_counts(const avl *tree, int *zero, int *one, int *two) {
 	*zero = *one = *two = 0;
+	avl_lock(tree);
 	avl_node_counts_aux(tree->root, zero, one, two);
+	avl_unlock(tree);
 	return;
 }
 
 int avl_leaf_count(const avl *tree) {
-	return avl_leaf_count_aux(tree->root);
+	avl_lock(tree);
+	int count = avl_leaf_count_aux(tree->root);
+	avl_unlock(tree);
+	return count;
 }
 
 int avl_one_child_count(const avl *tree) {
-	return avl_one_child_count_aux(tree->root);
+	avl_lock(tree);
+	int count = avl_one_child_count_aux(tree->root);
+	avl_unlock(tree);
+	return count;
 }
 
 int avl_two_child_count(const avl *tree) {
-	return avl_two_child_count_aux(tree->root);
+	avl_lock(tree);
+	int count = avl_two_child_count_aux(tree->root);
+	avl_unlock(tree);
+	return count;
 }
 
 int avl_balanced(const avl *tree) {
-	return avl_balanced_aux(tree->root);
+	avl_lock(tree);
+	int balanced = avl_balanced_aux(tree, tree->root);
+	avl_unlock(tree);
+	return balanced;
 }
 
 int avl_valid(const avl *tree) {
-	return avl_valid_aux(tree, tree->root, NULL, NULL);
+	avl_lock(tree);
+	int valid = avl_valid_aux(tree, tree->root, NULL, NULL);
+	avl_unlock(tree);
+	return valid;
 }
 
 int avl_equals(const avl *target, const avl *source) {
-	return avl_equals_aux(source, target->root, source->root);
+	int equals = 0;
+
+	avl_lock_pair(target, source);
+
+	if (target->hash == NULL || target->hash != source->hash
+			|| (target->size == source->size
+					&& avl_node_digest(target->root)
+							== avl_node_digest(source->root))) {
+		// Trees with different digests cannot be equal.
+		equals = avl_equals_aux(source, target->root, source->root);
+	}
+	avl_unlock_pair(target, source);
+	return equals;
+}
+
+void avl_enable_digest(avl *tree, data_hash hash) {
+	assert(hash != NULL);
+	assert(tree->sync == NULL || tree->hash != NULL);
+
+	avl_write_begin(tree);
+
+	if (tree->hash == NULL) {
+		// The nodes have no room for a digest: move them into nodes that do.
+		avl old = *tree;
+
+		if (old.pool != NULL) {
+			tree->pool = avl_pool_initialize(old.pool->chunk_size,
+					sizeof(avl_digest_node));
+		}
+		tree->hash = hash;
+		avl_rehome(tree, &old, &tree->root);
+
+		if (old.pool != NULL && old.pool->refs == 1) {
+			// Every node of the old pool has been released.
+			avl_pool_destroy(&old);
+		} else if (old.pool != NULL) {
+			// Snapshots still allocate from the old pool.
+			old.pool->refs--;
+		}
+	}
+	tree->hash = hash;
+	avl_digest_aux(tree, &tree->root);
+	avl_write_end(tree);
+	return;
+}
+
+uint64_t avl_digest(const avl *tree) {
+	assert(tree->hash != NULL);
+
+	avl_lock(tree);
+	uint64_t digest = avl_node_digest(tree->root);
+	avl_unlock(tree);
+	return digest;
+}
+
+int avl_same_values(const avl *target, const avl *source) {
+	int same = 0;
+
+	avl_lock_pair(target, source);
+
+	if (target->size != source->size) {
+		same = 0;
+	} else if (target->hash != NULL && target->hash == source->hash) {
+		same = avl_node_digest(target->root) == avl_node_digest(source->root);
+	} else {
+		// No digests - compare the values in order.
+		avl_cursor a;
+		avl_cursor b;
+		int more = avl_first(target, &a) && avl_first(source, &b);
+
+		same = 1;
+
+		while (same && more) {
+			same = target->compare(avl_cursor_value(&a), avl_cursor_value(&b))
+					== 0;
+			more = avl_next(&a) && avl_next(&b);
+		}
+	}
+	avl_unlock_pair(target, source);
+	return same;
+}
+
+int avl_diff(const avl *target, const avl *source, avl_diff_visitor visit,
+		void *context) {
+	assert(target->hash != NULL && target->hash == source->hash);
+	int count = 0;
+
+	avl_lock_pair(target, source);
+	avl_diff_aux(target, target->root, source, NULL, NULL, visit, context,
+			&count);
+	avl_unlock_pair(target, source);
+	return count;
+}
+
+avl_frozen* avl_freeze(const avl *tree) {
+	avl_frozen *image = malloc(sizeof *image);
+	assert(image != NULL);
+	avl_cursor cursor;
+
+	avl_lock(tree);
+	image->size = tree->size;
+	image->values = malloc((tree->size + 1) * sizeof *image->values);
+	assert(image->values != NULL);
+	image->copy = tree->copy;
+	image->compare = tree->compare;
+	avl_first(tree, &cursor);
+	avl_freeze_aux(image->values, image->size, 1, &cursor);
+	avl_unlock(tree);
+	return image;
+}
+
+void avl_frozen_destroy(avl_frozen **image) {
+	free((*image)->values);
+	free(*image);
+	*image = NULL;
+	return;
+}
+
+int avl_frozen_size(const avl_frozen *image) {
+	return image->size;
+}
+
+const data* avl_frozen_find(const avl_frozen *image, const data *key) {
+	int k = avl_frozen_lower(image, key);
+	const data *value = NULL;
+
+	if (k != 0 && image->compare(&image->values[k], key) == 0) {
+		value = &image->values[k];
+	}
+	return value;
+}
+
+data* avl_frozen_retrieve(const avl_frozen *image, const data *key) {
+	const data *found = avl_frozen_find(image, key);
+	data *value = NULL;
+
+	if (found != NULL) {
+		value = image->copy(found);
+	}
+	return value;
+}
+
+int avl_frozen_retrieve_into(const avl_frozen *image, const data *key,
+		data *value) {
+	const data *found = avl_frozen_find(image, key);
+
+	if (found != NULL) {
+		*value = *found;
+	}
+	return found != NULL;
+}
+
+data* avl_frozen_max(const avl_frozen *image) {
+	assert(image->size > 0);
+	int k = 1;
+
+	while (2 * k + 1 <= image->size) {
+		k = 2 * k + 1;
+	}
+	return image->copy(&image->values[k]);
+}
+
+data* avl_frozen_min(const avl_frozen *image) {
+	assert(image->size > 0);
+	int k = 1;
+
+	while (2 * k <= image->size) {
+		k = 2 * k;
+	}
+	return image->copy(&image->values[k]);
+}
+
+int avl_frozen_range(const avl_frozen *image, const data *lo, const data *hi,
+		avl_visitor visit, void *context) {
+	int k = avl_frozen_lower(image, lo);
+	int count = 0;
+	int more = k != 0;
+
+	// Stop at the first value past hi, or when the visitor asks to.
+	while (more && image->compare(&image->values[k], hi) >= 0) {
+		count++;
+		more = visit(&image->values[k], context);
+		k = avl_frozen_next(image->size, k);
+		more = more && k != 0;
+	}
+	return count;
+}
+
+int avl_save(const avl *tree, const char *path, data_serialize serialize) {
+	FILE *file = fopen(path, "wb");
+	int saved = 0;
+
+	if (file != NULL) {
+		size_t capacity = AVL_FILE_RECORD;
+		unsigned char *buffer = malloc(capacity);
+		assert(buffer != NULL);
+		avl_cursor cursor;
+		uint32_t count = 0;
+		int more = 0;
+
+		setvbuf(file, NULL, _IOFBF, AVL_FILE_BUFFER);
+		avl_lock(tree);
+		count = tree->size;
+		saved = fwrite(AVL_FILE_MAGIC, 1, AVL_FILE_MAGIC_SIZE, file)
+				== AVL_FILE_MAGIC_SIZE
+				&& fwrite(&count, sizeof count, 1, file) == 1;
+		more = avl_first(tree, &cursor);
+
+		// Write the values in order, each prefixed by its length.
+		while (saved && more) {
+			const data *value = avl_cursor_value(&cursor);
+			size_t length = serialize(buffer, capacity, value);
+
+			if (length > capacity) {
+				// The buffer is too small - grow it and try again.
+				capacity = length * 2;
+				buffer = realloc(buffer, capacity);
+				assert(buffer != NULL);
+				length = serialize(buffer, capacity, value);
+			}
+			uint32_t size = length;
+			saved = fwrite(&size, sizeof size, 1, file) == 1
+					&& fwrite(buffer, 1, length, file) == length;
+			more = avl_next(&cursor);
+		}
+		avl_unlock(tree);
+		free(buffer);
+		saved = fclose(file) == 0 && saved;
+	}
+	return saved;
+}
+
+avl* avl_load(const char *path, data_destroy destroy, data_copy copy,
+		data_to_string to_string, data_compare compare,
+		data_deserialize deserialize) {
+	FILE *file = fopen(path, "rb");
+	avl *tree = NULL;
+
+	if (file != NULL) {
+		size_t header = AVL_FILE_MAGIC_SIZE + sizeof(uint32_t);
+		long length = -1;
+
+		if (fseek(file, 0, SEEK_END) == 0) {
+			length = ftell(file);
+		}
+		if (length >= (long) header && fseek(file, 0, SEEK_SET) == 0) {
+			// Read the whole file at once, then build from memory.
+			unsigned char *contents = malloc(length);
+			assert(contents != NULL);
+			uint32_t count = 0;
+
+			if (fread(contents, 1, length, file) == (size_t) length
+					&& memcmp(contents, AVL_FILE_MAGIC, AVL_FILE_MAGIC_SIZE)
+							== 0) {
+				memcpy(&count, contents + AVL_FILE_MAGIC_SIZE, sizeof count);
+
+				if (count <= INT_MAX
+						&& avl_file_check(contents + header,
+								contents + length, count)) {
+					avl_file_reader reader = { contents + header, deserialize,
+							NULL, 1 };
+
+					tree = avl_initialize(destroy, copy, to_string, compare);
+					tree->root = avl_load_aux(tree, &reader, count);
+					tree->size = count;
+
+					if (!reader.ok) {
+						avl_destroy(&tree);
+					} else {
+						assert(avl_valid_aux(tree, tree->root, NULL, NULL));
+					}
+				}
+			}
+			free(contents);
+		}
+		fclose(file);
+	}
+	return tree;
+}
+
+void avl_stats(const avl *tree, avl_statistics *stats) {
+	avl_cursor cursor;
+	int more = 0;
+
+	memset(stats, 0, sizeof *stats);
+	avl_lock(tree);
+#ifdef AVL_STATS
+	avl_counters_add(&stats->counters, &tree->counters);
+#endif
+	stats->size = tree->size;
+	more = avl_first(tree, &cursor);
+
+	// The cursor path runs from the root to the current node. The height
+	// is measured, since a weak AVL stores ranks in place of heights.
+	while (more) {
+		stats->depths[cursor.depth - 1]++;
+
+		if (cursor.depth > stats->height) {
+			stats->height = cursor.depth;
+		}
+		more = avl_next(&cursor);
+	}
+	stats->memory = sizeof *tree + tree->size * sizeof(data);
+
+	if (tree->pool == NULL) {
+		stats->memory += tree->size * avl_node_size(tree);
+	} else {
+		// Whole chunks are held, whether their nodes are in use or not.
+		const avl_chunk *chunk = tree->pool->chunks;
+
+		stats->memory += sizeof *tree->pool;
+
+		while (chunk != NULL) {
+			stats->memory += sizeof *chunk
+					+ tree->pool->chunk_size * tree->pool->node_size;
+			chunk = chunk->next;
+		}
+	}
+	if (tree->sync != NULL) {
+		stats->memory += sizeof *tree->sync
+				+ tree->sync->retired_capacity * sizeof *tree->sync->retired;
+	}
+	avl_unlock(tree);
+	return;
 }
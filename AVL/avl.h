@@ -15,24 +15,192 @@
 // define and declare the data type
 #include "data.h"
 
+#include <stdint.h>
+
+// Longest possible search path: an AVL of INT_MAX nodes has a height of at
+// most 1.44 * log2(n) < 45, a weak AVL at most 2 * log2(n) < 62.
+#define AVL_MAX_HEIGHT 64
+
 // Structures
 
 typedef struct avl_node {
 	data *value; ///< Data stored in the node.
-	int height; ///< Height of the current node.
+	int height; ///< Height of the current node, its rank plus 1 if weak.
+	int count; ///< Number of nodes in the subtree rooted at this node.
+	int refs; ///< Number of trees and parent nodes linking to this node.
 	struct avl_node *left; ///< Pointer to the left child.
 	struct avl_node *right; ///< Pointer to the right child.
 } avl_node;
 
+// In a AVL that keeps digests each node is followed by the digest of its
+// subtree, so trees without digests do not pay for them.
+
+typedef struct avl_chunk {
+	struct avl_chunk *next; ///< Pointer to the next chunk in the pool.
+	int used; ///< Number of nodes handed out from this chunk.
+	avl_node nodes[]; ///< Contiguous node storage, pool->node_size apart.
+} avl_chunk;
+
+typedef struct avl_pool {
+	int chunk_size; ///< Number of nodes in each chunk.
+	size_t node_size; ///< Size of a node, with its digest if trees keep one.
+	int refs; ///< Number of trees allocating from the pool.
+	avl_chunk *chunks; ///< Pointer to the most recently allocated chunk.
+	avl_node *free; ///< Released nodes, linked through their right pointers.
+} avl_pool;
+
+typedef struct avl_sync avl_sync;
+
+/**
+ * Defines the rules a AVL rebalances by, see avl_set_balance.
+ */
+typedef enum {
+	AVL_BALANCE_STRICT, AVL_BALANCE_WEAK
+} avl_balance;
+
+/**
+ * Hashes a value for the subtree digests of a AVL. Values that should be
+ * treated as equal must hash the same.
+ * @param value Pointer to the value to hash.
+ * @return a hash of the value.
+ */
+typedef uint64_t (*data_hash)(const data *value);
+
+/**
+ * Combines a value into the value stored under the same key, for
+ * avl_upsert. The key of the stored value must not change.
+ * @param target Pointer to the stored value, changed in place.
+ * @param source Pointer to the value being upserted.
+ */
+typedef void (*data_merge)(data *target, const data *source);
+
+/**
+ * Makes the value to store for a key that is not yet in a AVL, for
+ * avl_get_or_insert.
+ * @param key Pointer to the key.
+ * @return a pointer to a new value with the same key, which the tree
+ * takes ownership of.
+ */
+typedef data* (*data_factory)(const data *key);
+
+/**
+ * Event counts of a AVL. They are kept only when the AVL is compiled with
+ * AVL_STATS defined; otherwise they are always 0 and counting them costs
+ * nothing.
+ */
+typedef struct {
+	long inserts; ///< Number of insert operations.
+	long removes; ///< Number of remove operations.
+	long lookups; ///< Number of find, retrieve and retrieve_into operations.
+	long compares; ///< Value comparisons made by the operations above.
+	long path_length; ///< Nodes visited by lookups, in total.
+	long single_rotations; ///< Single rotations made by rebalancing.
+	long double_rotations; ///< Double rotations made by rebalancing.
+	long allocations; ///< Nodes allocated.
+	long copies; ///< Values copied.
+	long destroys; ///< Values destroyed.
+} avl_counters;
+
+/**
+ * Statistics of a AVL, filled in by avl_stats.
+ */
+typedef struct {
+	avl_counters counters; ///< Event counts since the AVL was created.
+	int size; ///< Number of nodes in the AVL.
+	int height; ///< Height of the AVL.
+	int depths[AVL_MAX_HEIGHT]; ///< Number of nodes at each depth, root 0.
+	size_t memory; ///< Bytes used by the AVL, with sizeof(data) per value.
+} avl_statistics;
+
 typedef struct avl {
 	int size; ///< Number of nodes in the AVL.
 	avl_node *root; ///< Pointer to the root node of the AVL.
+	avl_pool *pool; ///< Node allocator, NULL if nodes are allocated singly.
+	avl_sync *sync; ///< Concurrency state, NULL unless enabled.
+	data_hash hash; ///< Value hash for subtree digests, NULL unless enabled.
+	avl_balance balance; ///< Rebalancing rules, AVL_BALANCE_STRICT by default.
+	unsigned long changes; ///< Number of changes made, to spot stale cursors.
+#ifdef AVL_STATS
+	avl_counters counters; ///< Event counts, see avl_stats.
+#endif
 	data_destroy destroy; ///< Pointer to data destroy function.
 	data_copy copy; ///< Pointer to data copy function.
 	data_to_string to_string; ///< Pointer to data to string function.
 	data_compare compare; ///< Pointer to data comparison function.
 } avl;
 
+/**
+ * Supplies values one at a time to avl_build_stream, which calls it
+ * exactly as many times as the count it is given.
+ * @param context Caller state passed through avl_build_stream.
+ * @return pointer to the next value, never NULL.
+ */
+typedef const data* (*avl_source)(void *context);
+
+/**
+ * Position in a AVL. Holds the path from the root down to the current node,
+ * so moving it never allocates. A cursor is invalidated by any change to
+ * the tree it points into.
+ */
+typedef struct {
+	const avl *tree; ///< Pointer to the AVL being traversed.
+	int depth; ///< Number of nodes on the path, 0 once past either end.
+	unsigned long changes; ///< The tree's changes when the path was taken.
+	const avl_node *path[AVL_MAX_HEIGHT]; ///< Nodes from the root down.
+} avl_cursor;
+
+/**
+ * Writes a value to a buffer for avl_save.
+ * @param buffer Buffer that receives the bytes of the value.
+ * @param size Size of the buffer.
+ * @param value Pointer to the value to write.
+ * @return the number of bytes in the value. If that is more than size the
+ * buffer contents are not used, and the call is repeated with a buffer
+ * large enough.
+ */
+typedef size_t (*data_serialize)(unsigned char *buffer, size_t size,
+		const data *value);
+
+/**
+ * Makes a value from the bytes written by a data_serialize, for avl_load.
+ * @param buffer The bytes of the value.
+ * @param size Number of bytes.
+ * @return a pointer to a new value, which the tree takes ownership of, or
+ * NULL if the bytes do not hold a value, which fails the load.
+ */
+typedef data* (*data_deserialize)(const unsigned char *buffer, size_t size);
+
+/**
+ * Read-only image of a AVL made by avl_freeze. The values are held in one
+ * array in Eytzinger (breadth-first) order: the children of index k are at
+ * 2k and 2k + 1. A search moves forward through the array, so the levels
+ * below the current one can be prefetched, and no pointers are followed.
+ */
+typedef struct {
+	int size; ///< Number of values in the image.
+	data *values; ///< Values in Eytzinger order, starting at index 1.
+	data_copy copy; ///< Pointer to data copy function.
+	data_compare compare; ///< Pointer to data comparison function.
+} avl_frozen;
+
+/**
+ * Called for each value visited by a traversal.
+ * @param value Pointer to the value stored in the tree (not a copy).
+ * @param context Caller state passed through the traversal.
+ * @return 1 to continue the traversal, 0 to stop it.
+ */
+typedef int (*avl_visitor)(const data *value, void *context);
+
+/**
+ * Called for each difference found by avl_diff.
+ * @param target The value in the target tree, NULL if it has none.
+ * @param source The value in the source tree, NULL if it has none.
+ * @param context Caller state passed through avl_diff.
+ * @return 1 to continue the diff, 0 to stop it.
+ */
+typedef int (*avl_diff_visitor)(const data *target, const data *source,
+		void *context);
+
 // Prototypes
 
 /**
@@ -42,6 +210,66 @@ typedef struct avl {
 avl* avl_initialize(data_destroy destroy, data_copy copy,
 		data_to_string to_string, data_compare compare);
 
+/**
+ * Switches an empty AVL to a slab allocator. Nodes are carved out of
+ * contiguous chunks of chunk_size nodes, removed nodes are reused by later
+ * inserts, and avl_destroy releases the nodes one chunk at a time.
+ * @param tree Pointer to an empty AVL.
+ * @param chunk_size Number of nodes allocated at once.
+ */
+void avl_enable_pool(avl *tree, int chunk_size);
+
+/**
+ * Chooses the rules an empty AVL rebalances by. AVL_BALANCE_STRICT keeps
+ * the heights of sibling subtrees within one of each other, which can take
+ * a rotation at every level of a remove. AVL_BALANCE_WEAK keeps a weak AVL
+ * (WAVL): node heights become ranks, each one or two above the ranks of its
+ * children. Inserts rebalance exactly as before, but a remove takes at most
+ * two rotations and O(1) amortized rank changes, for a tree at most twice
+ * as deep as log2(n) instead of 1.44 times. The nodes of a weak AVL cannot
+ * be moved into a strict one by avl_join, avl_union, avl_intersection or
+ * avl_difference.
+ * @param tree Pointer to an empty AVL.
+ * @param balance The rebalancing rules to use.
+ */
+void avl_set_balance(avl *tree, avl_balance balance);
+
+/**
+ * Allows a AVL to be shared between threads. Writers (insert, remove and
+ * the other functions that change the tree) are serialized on a writer
+ * lock. avl_retrieve, avl_retrieve_into, avl_min and avl_max never take
+ * the lock: they search optimistically and retry only if a writer changed
+ * the tree under a search that came up empty. Removed nodes are reclaimed
+ * once no reader can still be looking at them, so avl_remove returns a
+ * copy of the removed value. The remaining read functions take the writer
+ * lock for their duration. The lock-free readers load every link and
+ * value with acquire, so a value swapped in by avl_upsert is seen whole.
+ * The borrowing functions (avl_find, avl_get_or_insert, avl_retrieve_many,
+ * avl_find_min, avl_find_max and the cursor functions) are not safe while
+ * other threads write: the pointers they return can be freed by the next
+ * remove or upsert. The tree must not be in use by other threads when it
+ * is enabled or destroyed.
+ * @param tree Pointer to a AVL.
+ */
+void avl_enable_concurrency(avl *tree);
+
+/**
+ * Takes a snapshot of a AVL in O(1). The snapshot is a AVL in its own
+ * right that shares every node with tree, and it is fully writable: every
+ * function works on it as on any other AVL. Later inserts and removes on
+ * either tree copy only the O(log n) nodes they touch and leave the shared
+ * nodes alone, so each tree keeps its own contents until it is destroyed
+ * with avl_destroy. The shared nodes and pool are reference counted
+ * without locks, so a snapshot and the tree it was taken from, and any
+ * snapshots of either, must all be used and destroyed from one thread at
+ * a time. Snapshots, and the functions that move nodes between trees
+ * (avl_join, avl_split and the set operations), are not available in
+ * concurrent mode.
+ * @param tree Pointer to a AVL.
+ * @return a pointer to the snapshot.
+ */
+avl* avl_snapshot(avl *tree);
+
 /**
  * Deallocates memory for a AVL.
  * @param tree Pointer to a AVL.
@@ -77,6 +305,88 @@ int avl_size(const avl *tree);
  */
 int avl_insert(avl *tree, const data *value);
 
+/**
+ * Inserts data into a AVL, starting the search from a hint cursor instead
+ * of the root. The search climbs from the hint only as far as it must, so
+ * a value near the hint is placed in about O(log d) steps, where d is its
+ * distance from the hint, and a value past the end of a hint on the
+ * maximum in O(1) - appending sorted values costs O(1) amortized. The
+ * hint is used only if nothing has changed the tree since it was placed,
+ * as avl_insert_hint itself leaves it; a stale one, one into another
+ * tree, one past either end or a zeroed one starts from the root. The
+ * hint is ignored in concurrent mode.
+ * @param tree Pointer to a AVL.
+ * @param hint Pointer to a cursor, left on the value inserted, or on the
+ * value already matching it.
+ * @param value Value to insert into the tree.
+ * @return 1 if value is successfully inserted into the tree, 0 otherwise.
+ */
+int avl_insert_hint(avl *tree, avl_cursor *hint, const data *value);
+
+/**
+ * Inserts a copy of value into a AVL, or if its key is already there,
+ * merges value into the stored value in place. Either way the tree is
+ * searched once and rebalanced at most once, and nothing is copied for a
+ * merge. (In concurrent mode the stored value is copied and the merged
+ * copy swapped in, since readers may be copying it.)
+ * @param tree Pointer to a AVL.
+ * @param value Value to insert or merge.
+ * @param merge Function that merges value into the stored value, NULL to
+ * replace the stored value with a copy of value.
+ * @return 1 if value is inserted, 0 if it is merged.
+ */
+int avl_upsert(avl *tree, const data *value, data_merge merge);
+
+/**
+ * Finds the value matching key, inserting a new value made from key first
+ * if there is none, in a single search. The value returned can be changed
+ * in place, apart from its key, until the tree is next modified - but not
+ * in concurrent mode or when the tree keeps digests, where changes must go
+ * through avl_upsert.
+ * @param tree Pointer to a AVL.
+ * @param key Key value to search for.
+ * @param factory Function that makes the value to insert, NULL to insert a
+ * copy of key.
+ * @return pointer to the stored data matching key.
+ */
+data* avl_get_or_insert(avl *tree, const data *key, data_factory factory);
+
+/**
+ * Builds a AVL from values already sorted in tree order (no duplicates)
+ * in O(n) time, without comparisons or rotations.
+ * @param tree Pointer to an empty AVL.
+ * @param values Array of sorted values.
+ * @param n Number of values in the array.
+ */
+void avl_build_sorted(avl *tree, const data *values, int n);
+
+/**
+ * Builds a AVL from n sorted values (no duplicates) read one at a time
+ * from a source, so the values never need to be held in one array.
+ * @param tree Pointer to an empty AVL.
+ * @param next Function returning the next value in tree order. It is
+ * called exactly n times and must supply a value every time.
+ * @param context Caller state passed to next.
+ * @param n Number of values next will supply.
+ */
+void avl_build_stream(avl *tree, avl_source next, void *context, int n);
+
+/**
+ * Inserts a batch of values using several threads. The batch is sorted in
+ * parallel, the tree is split into one piece per thread, the threads insert
+ * into their own pieces, and the pieces are joined back together. Values
+ * already in the tree, and repeats within the batch after the first, are
+ * not inserted, as with avl_insert. Falls back to inserting the sorted
+ * batch one value at a time in concurrent mode or while the pool is shared
+ * with a snapshot. The copy function must be thread safe.
+ * @param tree Pointer to a AVL.
+ * @param values Array of values to insert, in any order.
+ * @param n Number of values in the array.
+ * @param nthreads Most threads to use.
+ * @return the number of values inserted.
+ */
+int avl_insert_batch(avl *tree, const data *values, int n, int nthreads);
+
 /**
  * Retrieves a copy of a value matching key in a AVL. (Iterative)
  * @param tree Pointer to a AVL.
@@ -86,6 +396,140 @@ int avl_insert(avl *tree, const data *value);
  */
 data* avl_retrieve(const avl *tree, const data *key);
 
+/**
+ * Finds the value matching key in a AVL without copying it. (Iterative)
+ * The pointer is owned by the tree: it must not be freed, and it is valid
+ * only until the tree is next modified or destroyed.
+ * @param tree Pointer to a AVL.
+ * @param key Key value to search for.
+ * @return pointer to the stored data if the key is found, NULL otherwise.
+ */
+const data* avl_find(const avl *tree, const data *key);
+
+/**
+ * Finds the value matching key without copying it, starting the search
+ * from a finger cursor instead of the root, as for avl_insert_hint. The
+ * finger is then moved to the first value not less than key, as by
+ * avl_seek, ready for the next search.
+ * @param tree Pointer to a AVL.
+ * @param finger Pointer to a cursor into tree, or one past either end. A
+ * finger placed before the last change to the tree starts from the root.
+ * @param key Key value to search for.
+ * @return pointer to the stored data if the key is found, NULL otherwise.
+ */
+const data* avl_find_near(const avl *tree, avl_cursor *finger,
+		const data *key);
+
+/**
+ * Finds the values matching many keys without copying them, as avl_find
+ * does for one. The searches are run in groups that advance a level at a
+ * time together, prefetching the nodes and values each next step needs,
+ * so the cache misses of one search overlap those of the others.
+ * @param tree Pointer to a AVL.
+ * @param keys Array of key values to search for.
+ * @param n Number of keys.
+ * @param values Array of n pointers that receive the stored data matching
+ * each key, NULL for a key that is not found.
+ * @return the number of keys found.
+ */
+int avl_retrieve_many(const avl *tree, const data keys[], int n,
+		const data *values[]);
+
+/**
+ * Copies the value matching key into caller-owned storage, the same
+ * member-wise copy avl_inorder makes. No memory is allocated.
+ * @param tree Pointer to a AVL.
+ * @param key Key value to search for.
+ * @param value Storage that receives the value found, if in AVL.
+ * @return 1 if the key is found in the tree, 0 otherwise.
+ */
+int avl_retrieve_into(const avl *tree, const data *key, data *value);
+
+/**
+ * Retrieves a copy of the value at position k of the tree's inorder
+ * traversal (the k-th smallest value, counting from 0). O(log n)
+ * @param tree Pointer to a AVL.
+ * @param k Position of the value to retrieve.
+ * @return copy of data if 0 <= k < size of tree, NULL otherwise.
+ */
+data* avl_select(const avl *tree, int k);
+
+/**
+ * Counts the values that come before key in the tree. O(log n)
+ * @param tree Pointer to a AVL.
+ * @param key Key value to search for.
+ * @return the number of values less than key, which is also the position
+ * key has or would have in the tree's inorder traversal.
+ */
+int avl_rank(const avl *tree, const data *key);
+
+/**
+ * Counts the values between two keys. O(log n)
+ * @param tree Pointer to a AVL.
+ * @param lo Lower key value, inclusive.
+ * @param hi Upper key value, inclusive.
+ * @return the number of values v with lo <= v <= hi.
+ */
+int avl_count_range(const avl *tree, const data *lo, const data *hi);
+
+/**
+ * Appends the values of source to target by joining the two trees in
+ * O(|height(target) - height(source)|). Every value in source must come
+ * after every value in target. The nodes are moved, not copied, and
+ * source is left empty.
+ * @param target Pointer to a AVL.
+ * @param source Pointer to a AVL.
+ */
+void avl_join(avl *target, avl *source);
+
+/**
+ * Splits a AVL around key in O(log n). The values before key stay in tree,
+ * and the values from key on are moved into a new tree.
+ * @param tree Pointer to a AVL.
+ * @param key Key value to split around.
+ * @return a pointer to a new AVL holding the values not less than key.
+ */
+avl* avl_split(avl *tree, const data *key);
+
+/**
+ * Moves the values of source into target. Values of source that are
+ * already in target are destroyed, and source is left empty. Runs in
+ * O(m log(n/m + 1)) for trees of sizes m <= n; pass avl_snapshot(source)
+ * to keep source. Nodes are moved rather than copied, unless the trees use
+ * different allocators.
+ * @param target Pointer to a AVL.
+ * @param source Pointer to a AVL.
+ */
+void avl_union(avl *target, avl *source);
+
+/**
+ * Keeps in target only the values that are also in source. The values
+ * removed from target and all the values in source are destroyed, and
+ * source is left empty. Runs in O(m log(n/m + 1)).
+ * @param target Pointer to a AVL.
+ * @param source Pointer to a AVL.
+ */
+void avl_intersection(avl *target, avl *source);
+
+/**
+ * Removes from target the values that are in source. The removed values and
+ * all the values in source are destroyed, and source is left empty. Runs
+ * in O(m log(n/m + 1)).
+ * @param target Pointer to a AVL.
+ * @param source Pointer to a AVL.
+ */
+void avl_difference(avl *target, avl *source);
+
+/**
+ * Removes and destroys the values between two keys. Runs in O(log n) plus
+ * the number of values removed.
+ * @param tree Pointer to a AVL.
+ * @param lo Lower key value, inclusive.
+ * @param hi Upper key value, inclusive.
+ * @return the number of values removed.
+ */
+int avl_remove_range(avl *tree, const data *lo, const data *hi);
+
 /**
  * Removes a node with a value matching key from the avl.
  * @param tree Pointer to a AVL.
@@ -116,6 +560,98 @@ void avl_preorder(const avl *tree, data *values);
  */
 void avl_postorder(const avl *tree, data *values);
 
+/**
+ * Calls visit with each value of a tree in order. Nothing is allocated and
+ * nothing recurses: the traversal keeps a path of at most AVL_MAX_HEIGHT
+ * nodes. The tree is locked for the whole traversal, so visit must not
+ * modify it.
+ * @param tree Pointer to a AVL.
+ * @param visit Function called with each value.
+ * @param context Caller state passed to visit.
+ * @return the number of values visited.
+ */
+int avl_foreach_inorder(const avl *tree, avl_visitor visit, void *context);
+
+/**
+ * Calls visit with each value of a tree in preorder, as for
+ * avl_foreach_inorder.
+ * @param tree Pointer to a AVL.
+ * @param visit Function called with each value.
+ * @param context Caller state passed to visit.
+ * @return the number of values visited.
+ */
+int avl_foreach_preorder(const avl *tree, avl_visitor visit, void *context);
+
+/**
+ * Calls visit with each value of a tree in postorder, as for
+ * avl_foreach_inorder.
+ * @param tree Pointer to a AVL.
+ * @param visit Function called with each value.
+ * @param context Caller state passed to visit.
+ * @return the number of values visited.
+ */
+int avl_foreach_postorder(const avl *tree, avl_visitor visit, void *context);
+
+/**
+ * Positions a cursor on the first value not less than key (lower bound).
+ * @param tree Pointer to a AVL.
+ * @param cursor Pointer to the cursor to position.
+ * @param key Key value to search for.
+ * @return 1 if the cursor is on a value, 0 if every value is less than key.
+ */
+int avl_seek(const avl *tree, avl_cursor *cursor, const data *key);
+
+/**
+ * Positions a cursor on the minimum value in the tree.
+ * @param tree Pointer to a AVL.
+ * @param cursor Pointer to the cursor to position.
+ * @return 1 if the cursor is on a value, 0 if the tree is empty.
+ */
+int avl_first(const avl *tree, avl_cursor *cursor);
+
+/**
+ * Positions a cursor on the maximum value in the tree.
+ * @param tree Pointer to a AVL.
+ * @param cursor Pointer to the cursor to position.
+ * @return 1 if the cursor is on a value, 0 if the tree is empty.
+ */
+int avl_last(const avl *tree, avl_cursor *cursor);
+
+/**
+ * Moves a cursor to the next value in order. Amortized O(1).
+ * @param cursor Pointer to a cursor on a value.
+ * @return 1 if the cursor is on a value, 0 if it moved past the end.
+ */
+int avl_next(avl_cursor *cursor);
+
+/**
+ * Moves a cursor to the previous value in order. Amortized O(1).
+ * @param cursor Pointer to a cursor on a value.
+ * @return 1 if the cursor is on a value, 0 if it moved past the start.
+ */
+int avl_prev(avl_cursor *cursor);
+
+/**
+ * Returns the value under a cursor without copying it. The pointer is
+ * owned by the tree and is valid until the tree is next modified.
+ * @param cursor Pointer to a cursor.
+ * @return pointer to the value, NULL if the cursor is past either end.
+ */
+const data* avl_cursor_value(const avl_cursor *cursor);
+
+/**
+ * Visits the values between two keys in order, without copying them.
+ * Only the O(log n) path to lo and the values in range are touched.
+ * @param tree Pointer to a AVL.
+ * @param lo Lower key value, inclusive.
+ * @param hi Upper key value, inclusive.
+ * @param visit Function called with each value in range.
+ * @param context Caller state passed to visit.
+ * @return the number of values visited.
+ */
+int avl_range(const avl *tree, const data *lo, const data *hi,
+		avl_visitor visit, void *context);
+
 /**
  * Find the maximum value in the tree.
  * @param tree Pointer to a tree.
@@ -130,6 +666,22 @@ data* avl_max(const avl *tree);
  */
 data* avl_min(const avl *tree);
 
+/**
+ * Finds the maximum value in the tree without copying it. The pointer is
+ * valid only until the tree is next modified or destroyed.
+ * @param tree Pointer to a tree.
+ * @return Pointer to the maximum value, NULL if the tree is empty.
+ */
+const data* avl_find_max(const avl *tree);
+
+/**
+ * Finds the minimum value in the tree without copying it. The pointer is
+ * valid only until the tree is next modified or destroyed.
+ * @param tree Pointer to a tree.
+ * @return Pointer to the minimum value, NULL if the tree is empty.
+ */
+const data* avl_find_min(const avl *tree);
+
 /**
  * Finds the number of leaf nodes in a tree.
  * @param tree Pointer to a AVL.
@@ -162,7 +714,8 @@ void avl_node_counts(const avl *tree, int *zero, int *one, int *two);
 
 /**
  * Determines whether or not a tree is a balanced tree.
- * All node heights are no more than one greater than any child heights.
+ * All node heights are no more than one greater than any child heights, or
+ * for a weak AVL, all node ranks are one or two greater than child ranks.
  * @param tree Pointer to a AVL.
  * @return
  */
@@ -177,10 +730,173 @@ int avl_valid(const avl *tree);
 
 /**
  * Determines if two trees contain same data in same configuration.
+ * Trees that keep digests with the same hash are known to differ in O(1)
+ * when their root digests differ.
  * @param target Pointer to an tree.
  * @param source Pointer to an tree.
  * @return 1 if trees are identical, 0 otherwise.
  */
 int avl_equals(const avl *target, const avl *source);
 
+/**
+ * Makes a AVL keep a digest in every node: the sum of the mixed hashes of
+ * the values in its subtree. Each node grows by the size of its digest,
+ * so the nodes already in the tree are moved into larger ones and their
+ * digests computed, in O(n). An insert or remove hashes only the value it
+ * adds or removes and adds the change to the digests on its path. Digests
+ * must be enabled before avl_enable_concurrency.
+ * @param tree Pointer to a AVL.
+ * @param hash The hash function for the AVL data.
+ */
+void avl_enable_digest(avl *tree, data_hash hash);
+
+/**
+ * Returns the digest of all the values in a AVL. Trees holding the same
+ * values have the same digest whatever their shape, so replicas can
+ * compare digests instead of values.
+ * @param tree Pointer to a AVL that keeps digests.
+ * @return the digest of the tree, 0 if it is empty.
+ */
+uint64_t avl_digest(const avl *tree);
+
+/**
+ * Determines if two trees hold the same values, whatever their shapes.
+ * Takes O(1) if both keep digests with the same hash. Otherwise the values
+ * are compared in order with the compare function, in O(n).
+ * @param target Pointer to a AVL.
+ * @param source Pointer to a AVL.
+ * @return 1 if the trees hold the same values, 0 otherwise.
+ */
+int avl_same_values(const avl *target, const avl *source);
+
+/**
+ * Reports the differences between two trees that keep digests with the
+ * same hash: values only in target, values only in source, and keys in
+ * both whose values hash differently. Key ranges whose digests match are
+ * skipped, so the time taken grows with the number of differences, not
+ * the size of the trees.
+ * @param target Pointer to a AVL.
+ * @param source Pointer to a AVL.
+ * @param visit Function called with each difference, in key order.
+ * @param context Caller state passed to visit.
+ * @return the number of differences reported.
+ */
+int avl_diff(const avl *target, const avl *source, avl_diff_visitor visit,
+		void *context);
+
+/**
+ * Makes a read-only image of a AVL for fast searching. As with avl_inorder,
+ * the image holds member-wise copies of the values, so data they point to
+ * is shared with the tree: the image must be destroyed before the tree's
+ * values are changed or destroyed.
+ * @param tree Pointer to a AVL.
+ * @return a pointer to a new frozen image of the tree.
+ */
+avl_frozen* avl_freeze(const avl *tree);
+
+/**
+ * Deallocates memory for a frozen image. The tree it was made from is not
+ * affected.
+ * @param image A frozen image handle.
+ */
+void avl_frozen_destroy(avl_frozen **image);
+
+/**
+ * Returns the number of values in a frozen image.
+ * @param image Pointer to a frozen image.
+ * @return The number of values stored in the image.
+ */
+int avl_frozen_size(const avl_frozen *image);
+
+/**
+ * Finds the value matching key in a frozen image without copying it.
+ * @param image Pointer to a frozen image.
+ * @param key Key value to search for.
+ * @return pointer to the stored data if the key is found, NULL otherwise.
+ */
+const data* avl_frozen_find(const avl_frozen *image, const data *key);
+
+/**
+ * Retrieves a copy of a value matching key in a frozen image.
+ * @param image Pointer to a frozen image.
+ * @param key Key value to search for.
+ * @return copy of data if the key is found in the image, NULL otherwise.
+ */
+data* avl_frozen_retrieve(const avl_frozen *image, const data *key);
+
+/**
+ * Copies the value matching key into caller-owned storage, member-wise
+ * and without allocating memory.
+ * @param image Pointer to a frozen image.
+ * @param key Key value to search for.
+ * @param value Storage that receives the value found, if in the image.
+ * @return 1 if the key is found in the image, 0 otherwise.
+ */
+int avl_frozen_retrieve_into(const avl_frozen *image, const data *key,
+		data *value);
+
+/**
+ * Returns a copy of the maximum value in a frozen image.
+ * @param image Pointer to a non-empty frozen image.
+ * @return Copy of maximum value in the image.
+ */
+data* avl_frozen_max(const avl_frozen *image);
+
+/**
+ * Returns a copy of the minimum value in a frozen image.
+ * @param image Pointer to a non-empty frozen image.
+ * @return Copy of minimum value in the image.
+ */
+data* avl_frozen_min(const avl_frozen *image);
+
+/**
+ * Visits the values of a frozen image between two keys in order.
+ * @param image Pointer to a frozen image.
+ * @param lo Lower key value, inclusive.
+ * @param hi Upper key value, inclusive.
+ * @param visit Function called with each value in range.
+ * @param context Caller state passed to visit.
+ * @return the number of values visited.
+ */
+int avl_frozen_range(const avl_frozen *image, const data *lo, const data *hi,
+		avl_visitor visit, void *context);
+
+/**
+ * Saves the values of a AVL to a binary file: a header holding the number
+ * of values, then each value in order, prefixed by its length. Integers
+ * are written in host byte order.
+ * @param tree Pointer to a AVL.
+ * @param path Name of the file to write.
+ * @param serialize Function that writes one value.
+ * @return 1 if the file was written, 0 otherwise.
+ */
+int avl_save(const avl *tree, const char *path, data_serialize serialize);
+
+/**
+ * Loads a AVL from a file written by avl_save. The file is read with a
+ * single read, and the tree is built from it in linear time.
+ * @param path Name of the file to read.
+ * @param destroy The destroy function for the AVL data.
+ * @param copy The copy function for the AVL data.
+ * @param to_string The to string function for the AVL data.
+ * @param compare The comparison function for the AVL data.
+ * @param deserialize Function that makes one value.
+ * @return A pointer to a new AVL, NULL if the file cannot be read, is
+ * not a complete AVL file, or holds a value that deserialize rejects or
+ * that does not come after the value before it.
+ */
+avl* avl_load(const char *path, data_destroy destroy, data_copy copy,
+		data_to_string to_string, data_compare compare,
+		data_deserialize deserialize);
+
+/**
+ * Reports the statistics of a AVL: its event counts, the number of nodes
+ * at each depth, and the memory it uses. The event counts are all 0 unless
+ * the AVL is compiled with AVL_STATS defined. Nodes shared with snapshots
+ * are counted in full.
+ * @param tree Pointer to a AVL.
+ * @param stats Storage that receives the statistics.
+ */
+void avl_stats(const avl *tree, avl_statistics *stats);
+
 #endif /* AVL_H_ */
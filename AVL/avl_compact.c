@@ -0,0 +1,756 @@
+/*
+ -------------------------------------------------------
+ avl_compact.c
+ Compact array-pool version of the AVL ADT.
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+#include "avl_compact.h"
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+// Bits of a link that hold the node index
+#define AVL_COMPACT_INDEX_MASK ((1u << AVL_COMPACT_INDEX_BITS) - 1)
+// Number of nodes allocated for a new tree
+#define AVL_COMPACT_INITIAL 64
+// Macros for data comparison
+#define LESS_THAN_EQUAL(x,y) compare((x), (y)) <= 0
+#define GREATER_THAN_EQUAL(x,y) compare((x), (y)) >= 0
+
+// Local Functions
+
+/**
+ * Returns the index of a node's left child.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of a node
+ * @return index of the left child, 0 if none
+ */
+static uint32_t avl_compact_left(const avl_compact *tree, uint32_t node) {
+	return tree->nodes[node].left & AVL_COMPACT_INDEX_MASK;
+}
+
+/**
+ * Returns the index of a node's right child.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of a node
+ * @return index of the right child, 0 if none
+ */
+static uint32_t avl_compact_right(const avl_compact *tree, uint32_t node) {
+	return tree->nodes[node].right;
+}
+
+/**
+ * Returns the index of one of a node's children.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of a node
+ * @param right 1 for the right child, 0 for the left child
+ * @return index of the child, 0 if none
+ */
+static uint32_t avl_compact_child(const avl_compact *tree, uint32_t node,
+		int right) {
+	return right ?
+			avl_compact_right(tree, node) : avl_compact_left(tree, node);
+}
+
+/**
+ * Sets a node's left child, keeping its balance factor.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of a node
+ * @param child index of the new left child, 0 for none
+ */
+static void avl_compact_set_left(avl_compact *tree, uint32_t node,
+		uint32_t child) {
+	tree->nodes[node].left = (tree->nodes[node].left & ~AVL_COMPACT_INDEX_MASK)
+			| child;
+	return;
+}
+
+/**
+ * Sets a node's right child.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of a node
+ * @param child index of the new right child, 0 for none
+ */
+static void avl_compact_set_right(avl_compact *tree, uint32_t node,
+		uint32_t child) {
+	tree->nodes[node].right = child;
+	return;
+}
+
+/**
+ * Returns the balance factor of a node: the height of its right subtree
+ * less the height of its left subtree.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of a node
+ * @return -1, 0 or 1
+ */
+static int avl_compact_balance(const avl_compact *tree, uint32_t node) {
+	return (int) (tree->nodes[node].left >> AVL_COMPACT_INDEX_BITS) - 1;
+}
+
+/**
+ * Sets the balance factor of a node.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of a node
+ * @param balance -1, 0 or 1
+ */
+static void avl_compact_set_balance(avl_compact *tree, uint32_t node,
+		int balance) {
+	tree->nodes[node].left = (tree->nodes[node].left & AVL_COMPACT_INDEX_MASK)
+			| ((uint32_t) (balance + 1) << AVL_COMPACT_INDEX_BITS);
+	return;
+}
+
+/**
+ * Allocates a node, reusing a removed node if there is one. The node
+ * storage may move, so node pointers must not be held across this call.
+ * @param tree pointer to a compact AVL tree
+ * @return index of an uninitialized node
+ */
+static uint32_t avl_compact_node_alloc(avl_compact *tree) {
+	uint32_t node = tree->free;
+
+	if (node != 0) {
+		tree->free = tree->nodes[node].right;
+	} else {
+		if (tree->used == tree->capacity) {
+			// Storage is exhausted - double it. Indexes stay valid.
+			assert(tree->capacity <= AVL_COMPACT_INDEX_MASK / 2);
+			tree->capacity *= 2;
+			tree->nodes = realloc(tree->nodes,
+					tree->capacity * sizeof *tree->nodes);
+			assert(tree->nodes != NULL);
+		}
+		node = tree->used;
+		tree->used++;
+	}
+	return node;
+}
+
+/**
+ * Returns a node to the tree's free list.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of an unlinked node
+ */
+static void avl_compact_node_release(avl_compact *tree, uint32_t node) {
+	// A NULL value marks the node as free for avl_compact_destroy.
+	tree->nodes[node].value = NULL;
+	tree->nodes[node].left = 0;
+	tree->nodes[node].right = tree->free;
+	tree->free = node;
+	return;
+}
+
+/**
+ * Points the link at depth in a search path to a new subtree.
+ * @param tree pointer to a compact AVL tree
+ * @param path indexes of the nodes from the root down
+ * @param dirs 1 where the path goes right, 0 where it goes left
+ * @param depth depth of the link, 0 for the root
+ * @param child index of the subtree root, 0 for none
+ */
+static void avl_compact_link(avl_compact *tree, const uint32_t path[],
+		const int dirs[], int depth, uint32_t child) {
+
+	if (depth == 0) {
+		tree->root = child;
+	} else if (dirs[depth - 1]) {
+		avl_compact_set_right(tree, path[depth - 1], child);
+	} else {
+		avl_compact_set_left(tree, path[depth - 1], child);
+	}
+	return;
+}
+
+/**
+ * Performs a left rotation. Balance factors are updated from the balance
+ * of the right child, so this works after both inserts and removes.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @return index of the new subtree root
+ */
+static uint32_t avl_compact_rotate_left(avl_compact *tree, uint32_t node) {
+	uint32_t temp = avl_compact_right(tree, node);
+
+	avl_compact_set_right(tree, node, avl_compact_left(tree, temp));
+	avl_compact_set_left(tree, temp, node);
+
+	if (avl_compact_balance(tree, temp) == 0) {
+		// Only happens on remove: the subtree keeps its height.
+		avl_compact_set_balance(tree, node, 1);
+		avl_compact_set_balance(tree, temp, -1);
+	} else {
+		avl_compact_set_balance(tree, node, 0);
+		avl_compact_set_balance(tree, temp, 0);
+	}
+	return temp;
+}
+
+/**
+ * Performs a right rotation.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @return index of the new subtree root
+ */
+static uint32_t avl_compact_rotate_right(avl_compact *tree, uint32_t node) {
+	uint32_t temp = avl_compact_left(tree, node);
+
+	avl_compact_set_left(tree, node, avl_compact_right(tree, temp));
+	avl_compact_set_right(tree, temp, node);
+
+	if (avl_compact_balance(tree, temp) == 0) {
+		// Only happens on remove: the subtree keeps its height.
+		avl_compact_set_balance(tree, node, -1);
+		avl_compact_set_balance(tree, temp, 1);
+	} else {
+		avl_compact_set_balance(tree, node, 0);
+		avl_compact_set_balance(tree, temp, 0);
+	}
+	return temp;
+}
+
+/**
+ * Performs a right-left double rotation.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @return index of the new subtree root
+ */
+static uint32_t avl_compact_rotate_right_left(avl_compact *tree,
+		uint32_t node) {
+	uint32_t right = avl_compact_right(tree, node);
+	uint32_t temp = avl_compact_left(tree, right);
+	int balance = avl_compact_balance(tree, temp);
+
+	avl_compact_set_left(tree, right, avl_compact_right(tree, temp));
+	avl_compact_set_right(tree, temp, right);
+	avl_compact_set_right(tree, node, avl_compact_left(tree, temp));
+	avl_compact_set_left(tree, temp, node);
+	avl_compact_set_balance(tree, node, balance > 0 ? -1 : 0);
+	avl_compact_set_balance(tree, right, balance < 0 ? 1 : 0);
+	avl_compact_set_balance(tree, temp, 0);
+	return temp;
+}
+
+/**
+ * Performs a left-right double rotation.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @return index of the new subtree root
+ */
+static uint32_t avl_compact_rotate_left_right(avl_compact *tree,
+		uint32_t node) {
+	uint32_t left = avl_compact_left(tree, node);
+	uint32_t temp = avl_compact_right(tree, left);
+	int balance = avl_compact_balance(tree, temp);
+
+	avl_compact_set_right(tree, left, avl_compact_left(tree, temp));
+	avl_compact_set_left(tree, temp, left);
+	avl_compact_set_left(tree, node, avl_compact_right(tree, temp));
+	avl_compact_set_right(tree, temp, node);
+	avl_compact_set_balance(tree, node, balance < 0 ? 1 : 0);
+	avl_compact_set_balance(tree, left, balance > 0 ? -1 : 0);
+	avl_compact_set_balance(tree, temp, 0);
+	return temp;
+}
+
+/**
+ * Rebalances a subtree whose balance factor has reached 2 or -2.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @param balance the out of range balance factor of node
+ * @return index of the new subtree root
+ */
+static uint32_t avl_compact_rebalance(avl_compact *tree, uint32_t node,
+		int balance) {
+	uint32_t root = 0;
+
+	if (balance > 0) {
+		if (avl_compact_balance(tree, avl_compact_right(tree, node)) < 0) {
+			// Right Left Case
+			root = avl_compact_rotate_right_left(tree, node);
+		} else {
+			// Right Right Case
+			root = avl_compact_rotate_left(tree, node);
+		}
+	} else {
+		if (avl_compact_balance(tree, avl_compact_left(tree, node)) > 0) {
+			// Left Right Case
+			root = avl_compact_rotate_left_right(tree, node);
+		} else {
+			// Left Left Case
+			root = avl_compact_rotate_right(tree, node);
+		}
+	}
+	return root;
+}
+
+/**
+ * Updates balance factors after a subtree on a path grew by one level,
+ * stopping once a subtree keeps its height.
+ * @param tree pointer to a compact AVL tree
+ * @param path indexes of the nodes from the root down
+ * @param dirs 1 where the path goes right, 0 where it goes left
+ * @param depth number of nodes on the path
+ */
+static void avl_compact_insert_retrace(avl_compact *tree,
+		const uint32_t path[], const int dirs[], int depth) {
+	int i = depth - 1;
+	int grew = 1;
+
+	while (i >= 0 && grew) {
+		int balance = avl_compact_balance(tree, path[i]) + (dirs[i] ? 1 : -1);
+
+		if (balance == 1 || balance == -1) {
+			// The subtree is one level taller.
+			avl_compact_set_balance(tree, path[i], balance);
+		} else if (balance == 0) {
+			avl_compact_set_balance(tree, path[i], balance);
+			grew = 0;
+		} else {
+			// A rotation restores the subtree's old height.
+			avl_compact_link(tree, path, dirs, i,
+					avl_compact_rebalance(tree, path[i], balance));
+			grew = 0;
+		}
+		i--;
+	}
+	return;
+}
+
+/**
+ * Updates balance factors after a subtree on a path shrank by one level,
+ * stopping once a subtree keeps its height.
+ * @param tree pointer to a compact AVL tree
+ * @param path indexes of the nodes from the root down
+ * @param dirs 1 where the path goes right, 0 where it goes left
+ * @param depth number of nodes on the path
+ */
+static void avl_compact_remove_retrace(avl_compact *tree,
+		const uint32_t path[], const int dirs[], int depth) {
+	int i = depth - 1;
+	int shrank = 1;
+
+	while (i >= 0 && shrank) {
+		int balance = avl_compact_balance(tree, path[i]) - (dirs[i] ? 1 : -1);
+
+		if (balance == 0) {
+			// The subtree is one level shorter.
+			avl_compact_set_balance(tree, path[i], balance);
+		} else if (balance == 1 || balance == -1) {
+			avl_compact_set_balance(tree, path[i], balance);
+			shrank = 0;
+		} else {
+			uint32_t root = avl_compact_rebalance(tree, path[i], balance);
+
+			avl_compact_link(tree, path, dirs, i, root);
+			// A rotation around a balanced child keeps the height.
+			shrank = avl_compact_balance(tree, root) == 0;
+		}
+		i--;
+	}
+	return;
+}
+
+/**
+ * Searches for key, recording the path from the root.
+ * @param tree pointer to a compact AVL tree
+ * @param key key value to search for
+ * @param path receives the indexes of the nodes above the match
+ * @param dirs receives 1 where the path goes right, 0 where it goes left
+ * @param depth receives the number of nodes above the match
+ * @return index of the matching node, 0 if there is none
+ */
+static uint32_t avl_compact_search_path(const avl_compact *tree,
+		const data *key, uint32_t path[], int dirs[], int *depth) {
+	uint32_t node = tree->root;
+	int d = 0;
+	int comp = 1;
+
+	while (node != 0 && comp != 0) {
+		comp = tree->compare(tree->nodes[node].value, key);
+
+		if (comp != 0) {
+			assert(d < AVL_COMPACT_MAX_HEIGHT);
+			path[d] = node;
+			dirs[d] = comp > 0;
+			d++;
+			node = avl_compact_child(tree, node, comp > 0);
+		}
+	}
+	*depth = d;
+	return node;
+}
+
+/**
+ * Traverses a subtree in inorder, copying its values to an array.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @param values array of data
+ * @param index position in values of the next value
+ * @return position in values after the subtree's values
+ */
+static int avl_compact_inorder_aux(const avl_compact *tree, uint32_t node,
+		data values[], int index) {
+
+	if (node != 0) {
+		index = avl_compact_inorder_aux(tree, avl_compact_left(tree, node),
+				values, index);
+		values[index] = *tree->nodes[node].value;
+		index++;
+		index = avl_compact_inorder_aux(tree, avl_compact_right(tree, node),
+				values, index);
+	}
+	return index;
+}
+
+/**
+ * Traverses a subtree in preorder, copying its values to an array.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @param values array of data
+ * @param index position in values of the next value
+ * @return position in values after the subtree's values
+ */
+static int avl_compact_preorder_aux(const avl_compact *tree, uint32_t node,
+		data values[], int index) {
+
+	if (node != 0) {
+		values[index] = *tree->nodes[node].value;
+		index++;
+		index = avl_compact_preorder_aux(tree, avl_compact_left(tree, node),
+				values, index);
+		index = avl_compact_preorder_aux(tree, avl_compact_right(tree, node),
+				values, index);
+	}
+	return index;
+}
+
+/**
+ * Traverses a subtree in postorder, copying its values to an array.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @param values array of data
+ * @param index position in values of the next value
+ * @return position in values after the subtree's values
+ */
+static int avl_compact_postorder_aux(const avl_compact *tree, uint32_t node,
+		data values[], int index) {
+
+	if (node != 0) {
+		index = avl_compact_postorder_aux(tree, avl_compact_left(tree, node),
+				values, index);
+		index = avl_compact_postorder_aux(tree, avl_compact_right(tree, node),
+				values, index);
+		values[index] = *tree->nodes[node].value;
+		index++;
+	}
+	return index;
+}
+
+/**
+ * Returns the index of the leftmost or rightmost node.
+ * @param tree pointer to a non-empty compact AVL tree
+ * @param right 1 for the rightmost node, 0 for the leftmost
+ * @return index of the node
+ */
+static uint32_t avl_compact_extreme(const avl_compact *tree, int right) {
+	assert(tree->root != 0);
+	uint32_t node = tree->root;
+
+	while (avl_compact_child(tree, node, right) != 0) {
+		node = avl_compact_child(tree, node, right);
+	}
+	return node;
+}
+
+/**
+ * Counts the nodes of a subtree with zero, one, and two children.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @param zero number of leaf nodes
+ * @param one number of nodes with one child
+ * @param two number of nodes with two children
+ */
+static void avl_compact_node_counts_aux(const avl_compact *tree,
+		uint32_t node, int *zero, int *one, int *two) {
+
+	if (node != 0) {
+		uint32_t left = avl_compact_left(tree, node);
+		uint32_t right = avl_compact_right(tree, node);
+
+		if (left == 0 && right == 0) {
+			// Base case: leaf node
+			(*zero)++;
+		} else if (left == 0 || right == 0) {
+			// One child
+			(*one)++;
+		} else {
+			// two children
+			(*two)++;
+		}
+		avl_compact_node_counts_aux(tree, left, zero, one, two);
+		avl_compact_node_counts_aux(tree, right, zero, one, two);
+	}
+	return;
+}
+
+/**
+ * Computes the height of a subtree, checking its balance on the way.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @return height of the subtree, -1 if it is not balanced
+ */
+static int avl_compact_height_aux(const avl_compact *tree, uint32_t node) {
+	int height = 0;
+
+	if (node != 0) {
+		int left = avl_compact_height_aux(tree, avl_compact_left(tree, node));
+		int right = avl_compact_height_aux(tree, avl_compact_right(tree, node));
+
+		if (left < 0 || right < 0 || abs(left - right) > 1) {
+			height = -1;
+		} else {
+			height = (left > right ? left : right) + 1;
+		}
+	}
+	return height;
+}
+
+/**
+ * Determines whether a subtree is a valid AVL.
+ * @param tree pointer to a compact AVL tree
+ * @param node index of the subtree root
+ * @param min_node index of the node every value must come after, 0 if none
+ * @param max_node index of the node every value must come before, 0 if none
+ * @param height receives the height of the subtree
+ * @return 1 if the subtree is valid, 0 otherwise
+ */
+static int avl_compact_valid_aux(const avl_compact *tree, uint32_t node,
+		uint32_t min_node, uint32_t max_node, int *height) {
+	int valid = 1;
+	int left = 0;
+	int right = 0;
+
+	*height = 0;
+
+	if (node != 0) {
+		const data *value = tree->nodes[node].value;
+
+		if (value == NULL) {
+			// Base case: a free node is linked into the tree
+			valid = 0;
+		} else if (min_node != 0
+				&& tree->LESS_THAN_EQUAL(tree->nodes[min_node].value, value)) {
+			// Base case: node value less = than min_node value
+			valid = 0;
+		} else if (max_node != 0
+				&& tree->GREATER_THAN_EQUAL(tree->nodes[max_node].value,
+						value)) {
+			// Base case: node value greater = max_node value
+			valid = 0;
+		} else {
+			valid = avl_compact_valid_aux(tree, avl_compact_left(tree, node),
+					min_node, node, &left)
+					&& avl_compact_valid_aux(tree,
+							avl_compact_right(tree, node), node, max_node,
+							&right)
+					&& avl_compact_balance(tree, node) == right - left;
+			*height = (left > right ? left : right) + 1;
+		}
+	}
+	return valid;
+}
+
+// Functions
+
+avl_compact* avl_compact_initialize(data_destroy destroy, data_copy copy,
+		data_to_string to_string, data_compare compare) {
+	avl_compact *tree = malloc(sizeof *tree);
+	assert(tree != NULL);
+
+	tree->capacity = AVL_COMPACT_INITIAL;
+	tree->nodes = malloc(tree->capacity * sizeof *tree->nodes);
+	assert(tree->nodes != NULL);
+	// Index 0 stands for no node.
+	tree->used = 1;
+	tree->free = 0;
+	tree->root = 0;
+	tree->size = 0;
+	tree->destroy = destroy;
+	tree->copy = copy;
+	tree->to_string = to_string;
+	tree->compare = compare;
+	return tree;
+}
+
+void avl_compact_destroy(avl_compact **tree) {
+
+	// Scan the storage rather than the tree: no recursion is needed.
+	for (uint32_t i = 1; i < (*tree)->used; i++) {
+
+		if ((*tree)->nodes[i].value != NULL) {
+			(*tree)->destroy(&(*tree)->nodes[i].value);
+		}
+	}
+	free((*tree)->nodes);
+	free(*tree);
+	*tree = NULL;
+	return;
+}
+
+int avl_compact_empty(const avl_compact *tree) {
+	return tree->root == 0;
+}
+
+int avl_compact_full(const avl_compact *tree) {
+	return tree->free == 0 && tree->used > AVL_COMPACT_INDEX_MASK;
+}
+
+int avl_compact_size(const avl_compact *tree) {
+	return tree->size;
+}
+
+int avl_compact_insert(avl_compact *tree, const data *value) {
+	uint32_t path[AVL_COMPACT_MAX_HEIGHT];
+	int dirs[AVL_COMPACT_MAX_HEIGHT];
+	int depth = 0;
+	int inserted = 0;
+	uint32_t node = avl_compact_search_path(tree, value, path, dirs, &depth);
+
+	if (node == 0) {
+		// Add a new leaf and update the balance of its ancestors.
+		node = avl_compact_node_alloc(tree);
+		tree->nodes[node].value = tree->copy(value);
+		tree->nodes[node].left = 0;
+		tree->nodes[node].right = 0;
+		avl_compact_set_balance(tree, node, 0);
+		avl_compact_link(tree, path, dirs, depth, node);
+		tree->size++;
+		avl_compact_insert_retrace(tree, path, dirs, depth);
+		inserted = 1;
+	}
+	return inserted;
+}
+
+const data* avl_compact_find(const avl_compact *tree, const data *key) {
+	uint32_t node = tree->root;
+	int comp = 1;
+
+	while (node != 0 && comp != 0) {
+		comp = tree->compare(tree->nodes[node].value, key);
+
+		if (comp != 0) {
+			node = avl_compact_child(tree, node, comp > 0);
+		}
+	}
+	return node != 0 ? tree->nodes[node].value : NULL;
+}
+
+data* avl_compact_retrieve(const avl_compact *tree, const data *key) {
+	const data *found = avl_compact_find(tree, key);
+	data *value = NULL;
+
+	if (found != NULL) {
+		value = tree->copy(found);
+	}
+	return value;
+}
+
+int avl_compact_retrieve_into(const avl_compact *tree, const data *key,
+		data *value) {
+	const data *found = avl_compact_find(tree, key);
+
+	if (found != NULL) {
+		*value = *found;
+	}
+	return found != NULL;
+}
+
+data* avl_compact_remove(avl_compact *tree, const data *key) {
+	uint32_t path[AVL_COMPACT_MAX_HEIGHT];
+	int dirs[AVL_COMPACT_MAX_HEIGHT];
+	int depth = 0;
+	data *value = NULL;
+	uint32_t target = avl_compact_search_path(tree, key, path, dirs, &depth);
+
+	if (target != 0) {
+		uint32_t victim = target;
+
+		value = tree->nodes[target].value;
+
+		if (avl_compact_left(tree, target) != 0
+				&& avl_compact_right(tree, target) != 0) {
+			// Move the largest value of the left subtree into target and
+			// remove its node instead.
+			path[depth] = target;
+			dirs[depth] = 0;
+			depth++;
+			victim = avl_compact_left(tree, target);
+
+			while (avl_compact_right(tree, victim) != 0) {
+				assert(depth < AVL_COMPACT_MAX_HEIGHT);
+				path[depth] = victim;
+				dirs[depth] = 1;
+				depth++;
+				victim = avl_compact_right(tree, victim);
+			}
+			tree->nodes[target].value = tree->nodes[victim].value;
+		}
+		// victim has at most one child, which takes its place.
+		avl_compact_link(tree, path, dirs, depth,
+				avl_compact_left(tree, victim) != 0 ?
+						avl_compact_left(tree, victim) :
+						avl_compact_right(tree, victim));
+		avl_compact_node_release(tree, victim);
+		tree->size--;
+		avl_compact_remove_retrace(tree, path, dirs, depth);
+	}
+	return value;
+}
+
+void avl_compact_inorder(const avl_compact *tree, data *values) {
+	avl_compact_inorder_aux(tree, tree->root, values, 0);
+	return;
+}
+
+void avl_compact_preorder(const avl_compact *tree, data *values) {
+	avl_compact_preorder_aux(tree, tree->root, values, 0);
+	return;
+}
+
+void avl_compact_postorder(const avl_compact *tree, data *values) {
+	avl_compact_postorder_aux(tree, tree->root, values, 0);
+	return;
+}
+
+data* avl_compact_max(const avl_compact *tree) {
+	return tree->copy(tree->nodes[avl_compact_extreme(tree, 1)].value);
+}
+
+data* avl_compact_min(const avl_compact *tree) {
+	return tree->copy(tree->nodes[avl_compact_extreme(tree, 0)].value);
+}
+
+void avl_compact_node_counts(const avl_compact *tree, int *zero, int *one,
+		int *two) {
+	*zero = *one = *two = 0;
+	avl_compact_node_counts_aux(tree, tree->root, zero, one, two);
+	return;
+}
+
+int avl_compact_balanced(const avl_compact *tree) {
+	return avl_compact_height_aux(tree, tree->root) >= 0;
+}
+
+int avl_compact_valid(const avl_compact *tree) {
+	int height = 0;
+
+	return avl_compact_valid_aux(tree, tree->root, 0, 0, &height);
+}
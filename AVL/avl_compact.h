@@ -0,0 +1,199 @@
+/*
+ -------------------------------------------------------
+ avl_compact.h
+ Compact array-pool version of the AVL ADT.
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+#ifndef AVL_COMPACT_H_
+#define AVL_COMPACT_H_
+
+// define and declare the data type
+#include "data.h"
+
+#include <stdint.h>
+
+// Longest possible search path: a compact AVL holds fewer than 2^30 nodes,
+// so its height is at most 1.44 * 30 < 44.
+#define AVL_COMPACT_MAX_HEIGHT 48
+// Number of bits of a link that hold a node index. The balance factor
+// is kept in the remaining two bits of the left link.
+#define AVL_COMPACT_INDEX_BITS 30
+
+// Structures
+
+/**
+ * 16-byte node. Children are indexes into the tree's node array, with 0
+ * meaning no child, and the node's height is replaced by its balance
+ * factor.
+ */
+typedef struct {
+	data *value; ///< Data stored in the node.
+	uint32_t left; ///< Index of the left child, and the balance factor.
+	uint32_t right; ///< Index of the right child.
+} avl_compact_node;
+
+typedef struct {
+	int size; ///< Number of nodes in the AVL.
+	uint32_t root; ///< Index of the root node of the AVL.
+	avl_compact_node *nodes; ///< Node storage, indexed from 1.
+	uint32_t capacity; ///< Number of nodes the storage can hold.
+	uint32_t used; ///< Number of nodes handed out from the storage.
+	uint32_t free; ///< Index of the first removed node, 0 if none.
+	data_destroy destroy; ///< Pointer to data destroy function.
+	data_copy copy; ///< Pointer to data copy function.
+	data_to_string to_string; ///< Pointer to data to string function.
+	data_compare compare; ///< Pointer to data comparison function.
+} avl_compact;
+
+// Prototypes
+
+/**
+ * Allocates memory and initializes a compact AVL structure.
+ * @param destroy The destroy function for the AVL data.
+ * @param copy The copy function for the AVL data.
+ * @param to_string The to string function for the AVL data.
+ * @param data_compare The comparison function for the AVL data.
+ * @return A pointer to a new compact AVL.
+ */
+avl_compact* avl_compact_initialize(data_destroy destroy, data_copy copy,
+		data_to_string to_string, data_compare compare);
+
+/**
+ * Deallocates memory for a compact AVL.
+ * @param tree A compact AVL handle.
+ */
+void avl_compact_destroy(avl_compact **tree);
+
+/**
+ * Determines if a compact AVL is empty.
+ * @param tree Pointer to a compact AVL.
+ * @return 1 if the AVL is empty, 0 otherwise.
+ */
+int avl_compact_empty(const avl_compact *tree);
+
+/**
+ * Determines if a compact AVL is full.
+ * @param tree Pointer to a compact AVL.
+ * @return 1 if the AVL is full, 0 otherwise.
+ */
+int avl_compact_full(const avl_compact *tree);
+
+/**
+ * Returns the number of elements in a compact AVL.
+ * @param tree Pointer to a compact AVL.
+ * @return The number of values stored in the AVL.
+ */
+int avl_compact_size(const avl_compact *tree);
+
+/**
+ * Inserts a copy of value into a compact AVL.
+ * @param tree Pointer to a compact AVL.
+ * @param value Value to insert into the tree.
+ * @return 1 if value is successfully inserted into the tree, 0 otherwise.
+ */
+int avl_compact_insert(avl_compact *tree, const data *value);
+
+/**
+ * Retrieves a copy of a value matching key in a compact AVL.
+ * @param tree Pointer to a compact AVL.
+ * @param key Key value to search for.
+ * @return copy of data if the key is found in the tree, NULL otherwise.
+ */
+data* avl_compact_retrieve(const avl_compact *tree, const data *key);
+
+/**
+ * Finds the value matching key in a compact AVL without copying it. The
+ * pointer is owned by the tree and is valid only until the tree is next
+ * modified or destroyed.
+ * @param tree Pointer to a compact AVL.
+ * @param key Key value to search for.
+ * @return pointer to the stored data if the key is found, NULL otherwise.
+ */
+const data* avl_compact_find(const avl_compact *tree, const data *key);
+
+/**
+ * Copies the value matching key into caller-owned storage, member-wise
+ * and without allocating memory.
+ * @param tree Pointer to a compact AVL.
+ * @param key Key value to search for.
+ * @param value Storage that receives the value found, if in AVL.
+ * @return 1 if the key is found in the AVL, 0 otherwise.
+ */
+int avl_compact_retrieve_into(const avl_compact *tree, const data *key,
+		data *value);
+
+/**
+ * Removes a node with a value matching key from a compact AVL.
+ * @param tree Pointer to a compact AVL.
+ * @param key Key value to search for.
+ * @return pointer to data if the key is found in the AVL, NULL otherwise.
+ */
+data* avl_compact_remove(avl_compact *tree, const data *key);
+
+/**
+ * Copies the contents of the tree to an array in inorder.
+ * @param tree Pointer to a compact AVL.
+ * @param values An array of data large enough to hold the tree's values.
+ */
+void avl_compact_inorder(const avl_compact *tree, data *values);
+
+/**
+ * Copies the contents of the tree to an array in preorder.
+ * @param tree Pointer to a compact AVL.
+ * @param values An array of data large enough to hold the tree's values.
+ */
+void avl_compact_preorder(const avl_compact *tree, data *values);
+
+/**
+ * Copies the contents of the tree to an array in postorder.
+ * @param tree Pointer to a compact AVL.
+ * @param values An array of data large enough to hold the tree's values.
+ */
+void avl_compact_postorder(const avl_compact *tree, data *values);
+
+/**
+ * Returns a copy of the maximum value in the tree.
+ * @param tree Pointer to a non-empty compact AVL.
+ * @return Copy of maximum value in the AVL.
+ */
+data* avl_compact_max(const avl_compact *tree);
+
+/**
+ * Returns a copy of the minimum value in the tree.
+ * @param tree Pointer to a non-empty compact AVL.
+ * @return Copy of minimum value in the AVL.
+ */
+data* avl_compact_min(const avl_compact *tree);
+
+/**
+ * Determines the number of nodes with zero, one, and two children.
+ * @param tree Pointer to a compact AVL.
+ * @param zero Number of leaf nodes (no children).
+ * @param one Number of nodes with one child.
+ * @param two Number of nodes with two children.
+ */
+void avl_compact_node_counts(const avl_compact *tree, int *zero, int *one,
+		int *two);
+
+/**
+ * Determines whether or not a tree is a balanced tree. Heights are not
+ * stored, so they are computed from the leaves up.
+ * @param tree Pointer to a compact AVL.
+ * @return 1 if the tree is balanced, 0 otherwise.
+ */
+int avl_compact_balanced(const avl_compact *tree);
+
+/**
+ * Determines whether or not a tree is a valid AVL: ordered, balanced, and
+ * with every stored balance factor matching the subtree heights.
+ * @param tree Pointer to a compact AVL.
+ * @return 1 if the tree is a valid AVL, 0 otherwise.
+ */
+int avl_compact_valid(const avl_compact *tree);
+
+#endif /* AVL_COMPACT_H_ */
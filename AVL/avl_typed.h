@@ -0,0 +1,464 @@
+/*
+ -------------------------------------------------------
+ avl_typed.h
+ Type-specialized version of the AVL ADT, generated at compile time.
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+#ifndef AVL_TYPED_H_
+#define AVL_TYPED_H_
+
+// Includes
+#include <stdlib.h>
+#include <assert.h>
+
+#ifndef AVL_MAX_HEIGHT
+// Longest possible search path, the same as in avl.h.
+#define AVL_MAX_HEIGHT 64
+#endif
+
+/**
+ * Defines a AVL specialized for one key type. The key is stored inline in
+ * the node and cmp_expr is expanded directly into the search loops, so a
+ * lookup makes no function calls and follows one pointer per level.
+ *
+ * cmp_expr is an expression in a (a stored key) and b (the key being
+ * inserted or searched for), with the same meaning as data_compare:
+ * negative if b belongs in the left subtree of a, positive for the right
+ * subtree, 0 if they match. Keys are passed, returned and copied by
+ * value, so key_type cannot be an array type such as char[16]; wrap the
+ * array in a struct instead (see the second example below).
+ *
+ * AVL_DEFINE(name, key_type, cmp_expr) declares the types name_node and
+ * name, and the functions below, which mirror avl.h:
+ *
+ *  name*     name_initialize(void)
+ *  void      name_destroy(name **tree)
+ *  int       name_empty(const name *tree)
+ *  int       name_full(const name *tree)
+ *  int       name_size(const name *tree)
+ *  int       name_insert(name *tree, key_type value)
+ *  int       name_retrieve(const name *tree, key_type key, key_type *value)
+ *  const key_type* name_find(const name *tree, key_type key)
+ *  int       name_remove(name *tree, key_type key, key_type *value)
+ *  void      name_inorder(const name *tree, key_type *values)
+ *  void      name_preorder(const name *tree, key_type *values)
+ *  void      name_postorder(const name *tree, key_type *values)
+ *  key_type  name_max(const name *tree)
+ *  key_type  name_min(const name *tree)
+ *  void      name_node_counts(const name *tree, int *zero, int *one, int *two)
+ *  int       name_leaf_count(const name *tree)
+ *  int       name_one_child_count(const name *tree)
+ *  int       name_two_child_count(const name *tree)
+ *  int       name_balanced(const name *tree)
+ *  int       name_valid(const name *tree)
+ *  int       name_equals(const name *target, const name *source)
+ *
+ * Examples:
+ *  AVL_DEFINE(int_avl, int, (b > a) - (b < a))
+ *
+ *  typedef struct {
+ *      char text[16];
+ *  } word;
+ *  AVL_DEFINE(word_avl, word, strcmp(b.text, a.text))
+ *
+ * Benchmark/avl_typed_bench.c instantiates both.
+ */
+#define AVL_DEFINE(name, key_type, cmp_expr) \
+\
+typedef struct name##_node { \
+	key_type key; /* Key stored in the node. */ \
+	int height; /* Height of the current node. */ \
+	struct name##_node *left; /* Pointer to the left child. */ \
+	struct name##_node *right; /* Pointer to the right child. */ \
+} name##_node; \
+\
+typedef struct name { \
+	int size; /* Number of nodes in the AVL. */ \
+	name##_node *root; /* Pointer to the root node of the AVL. */ \
+} name; \
+\
+/* Compares a stored key a with the key b. */ \
+static inline int name##_compare(const key_type *pa, const key_type *pb) { \
+	const key_type a = *pa; \
+	const key_type b = *pb; \
+	(void) a; \
+	(void) b; \
+	return (cmp_expr); \
+} \
+\
+static inline int name##_node_height(const name##_node *node) { \
+	return node != NULL ? node->height : 0; \
+} \
+\
+static inline void name##_update_height(name##_node *node) { \
+	int left_height = name##_node_height(node->left); \
+	int right_height = name##_node_height(node->right); \
+\
+	node->height = (left_height > right_height ? left_height : right_height) \
+			+ 1; \
+} \
+\
+static inline name##_node* name##_rotate_left(name##_node *node) { \
+	name##_node *temp = node->right; \
+	node->right = temp->left; \
+	temp->left = node; \
+	name##_update_height(node); \
+	name##_update_height(temp); \
+	return temp; \
+} \
+\
+static inline name##_node* name##_rotate_right(name##_node *node) { \
+	name##_node *temp = node->left; \
+	node->left = temp->right; \
+	temp->right = node; \
+	name##_update_height(node); \
+	name##_update_height(temp); \
+	return temp; \
+} \
+\
+static inline int name##_balance_value(const name##_node *node) { \
+	return name##_node_height(node->left) - name##_node_height(node->right); \
+} \
+\
+static inline void name##_rebalance(name##_node **node) { \
+	name##_update_height(*node); \
+	int balance = name##_balance_value(*node); \
+\
+	if (balance > 1) { \
+		if (name##_balance_value((*node)->left) < 0) { \
+			/* Left Right Case - double rotation */ \
+			(*node)->left = name##_rotate_left((*node)->left); \
+		} \
+		*node = name##_rotate_right(*node); \
+	} else if (balance < -1) { \
+		if (name##_balance_value((*node)->right) > 0) { \
+			/* Right Left Case - double rotation */ \
+			(*node)->right = name##_rotate_right((*node)->right); \
+		} \
+		*node = name##_rotate_left(*node); \
+	} \
+} \
+\
+/* Rebalances bottom-up until a subtree keeps its height. */ \
+static inline void name##_retrace(name##_node **path[], int depth) { \
+	for (int i = depth; i >= 0; i--) { \
+		int height = (*path[i])->height; \
+		name##_rebalance(path[i]); \
+\
+		if ((*path[i])->height == height) { \
+			break; \
+		} \
+	} \
+} \
+\
+static inline name##_node** name##_search_path(const name *tree, \
+		const key_type *key, name##_node **path[], int *depth) { \
+	name##_node **link = (name##_node**) &tree->root; \
+	int d = 0; \
+\
+	path[d] = link; \
+\
+	while (*link != NULL) { \
+		int comp = name##_compare(&(*link)->key, key); \
+\
+		if (comp < 0) { \
+			link = &(*link)->left; \
+		} else if (comp > 0) { \
+			link = &(*link)->right; \
+		} else { \
+			break; \
+		} \
+		d++; \
+		assert(d < AVL_MAX_HEIGHT); \
+		path[d] = link; \
+	} \
+	*depth = d; \
+	return link; \
+} \
+\
+static inline int name##_inorder_aux(const name##_node *node, \
+		key_type values[], int index) { \
+	if (node != NULL) { \
+		index = name##_inorder_aux(node->left, values, index); \
+		values[index++] = node->key; \
+		index = name##_inorder_aux(node->right, values, index); \
+	} \
+	return index; \
+} \
+\
+static inline int name##_preorder_aux(const name##_node *node, \
+		key_type values[], int index) { \
+	if (node != NULL) { \
+		values[index++] = node->key; \
+		index = name##_preorder_aux(node->left, values, index); \
+		index = name##_preorder_aux(node->right, values, index); \
+	} \
+	return index; \
+} \
+\
+static inline int name##_postorder_aux(const name##_node *node, \
+		key_type values[], int index) { \
+	if (node != NULL) { \
+		index = name##_postorder_aux(node->left, values, index); \
+		index = name##_postorder_aux(node->right, values, index); \
+		values[index++] = node->key; \
+	} \
+	return index; \
+} \
+\
+static inline void name##_destroy_aux(name##_node *node) { \
+	if (node != NULL) { \
+		name##_destroy_aux(node->left); \
+		name##_destroy_aux(node->right); \
+		free(node); \
+	} \
+} \
+\
+static inline void name##_node_counts_aux(const name##_node *node, \
+		int *zero, int *one, int *two) { \
+	if (node != NULL) { \
+		if (node->left == NULL && node->right == NULL) { \
+			(*zero)++; \
+		} else if (node->left == NULL || node->right == NULL) { \
+			(*one)++; \
+		} else { \
+			(*two)++; \
+		} \
+		name##_node_counts_aux(node->left, zero, one, two); \
+		name##_node_counts_aux(node->right, zero, one, two); \
+	} \
+} \
+\
+static inline int name##_balanced_aux(const name##_node *node) { \
+	return node == NULL \
+			|| (abs(name##_balance_value(node)) <= 1 \
+					&& name##_balanced_aux(node->left) \
+					&& name##_balanced_aux(node->right)); \
+} \
+\
+static inline int name##_valid_aux(const name##_node *node, \
+		const name##_node *min_node, const name##_node *max_node) { \
+	int valid = 1; \
+\
+	if (node != NULL) { \
+		valid = (min_node == NULL \
+				|| name##_compare(&min_node->key, &node->key) > 0) \
+				&& (max_node == NULL \
+						|| name##_compare(&max_node->key, &node->key) < 0) \
+				&& abs(name##_balance_value(node)) <= 1 \
+				&& node->height == (name##_node_height(node->left) \
+						> name##_node_height(node->right) ? \
+						name##_node_height(node->left) : \
+						name##_node_height(node->right)) + 1 \
+				&& name##_valid_aux(node->left, min_node, node) \
+				&& name##_valid_aux(node->right, node, max_node); \
+	} \
+	return valid; \
+} \
+\
+static inline int name##_equals_aux(const name##_node *target, \
+		const name##_node *source) { \
+	return target == source \
+			|| (target != NULL && source != NULL \
+					&& name##_compare(&target->key, &source->key) == 0 \
+					&& name##_equals_aux(target->left, source->left) \
+					&& name##_equals_aux(target->right, source->right)); \
+} \
+\
+static inline name* name##_initialize(void) { \
+	name *tree = malloc(sizeof *tree); \
+	assert(tree != NULL); \
+\
+	tree->root = NULL; \
+	tree->size = 0; \
+	return tree; \
+} \
+\
+static inline void name##_destroy(name **tree) { \
+	name##_destroy_aux((*tree)->root); \
+	free(*tree); \
+	*tree = NULL; \
+} \
+\
+static inline int name##_empty(const name *tree) { \
+	return tree->root == NULL; \
+} \
+\
+static inline int name##_full(const name *tree) { \
+	(void) tree; \
+	return 0; \
+} \
+\
+static inline int name##_size(const name *tree) { \
+	return tree->size; \
+} \
+\
+static inline int name##_insert(name *tree, key_type value) { \
+	name##_node **path[AVL_MAX_HEIGHT]; \
+	int depth = 0; \
+	int inserted = 0; \
+	name##_node **link = name##_search_path(tree, &value, path, &depth); \
+\
+	if (*link == NULL) { \
+		name##_node *node = malloc(sizeof *node); \
+		assert(node != NULL); \
+		node->key = value; \
+		node->height = 1; \
+		node->left = NULL; \
+		node->right = NULL; \
+		*link = node; \
+		tree->size++; \
+		name##_retrace(path, depth - 1); \
+		inserted = 1; \
+	} \
+	return inserted; \
+} \
+\
+static inline const key_type* name##_find(const name *tree, key_type key) { \
+	const name##_node *node = tree->root; \
+\
+	while (node != NULL) { \
+		int comp = name##_compare(&node->key, &key); \
+\
+		if (comp == 0) { \
+			break; \
+		} \
+		node = comp < 0 ? node->left : node->right; \
+	} \
+	return node != NULL ? &node->key : NULL; \
+} \
+\
+static inline int name##_retrieve(const name *tree, key_type key, \
+		key_type *value) { \
+	const key_type *found = name##_find(tree, key); \
+\
+	if (found != NULL) { \
+		*value = *found; \
+	} \
+	return found != NULL; \
+} \
+\
+static inline int name##_remove(name *tree, key_type key, key_type *value) { \
+	name##_node **path[AVL_MAX_HEIGHT]; \
+	int depth = 0; \
+	int removed = 0; \
+	name##_node **link = name##_search_path(tree, &key, path, &depth); \
+\
+	if (*link != NULL) { \
+		name##_node *target = *link; \
+		int d = depth; \
+\
+		if (target->left == NULL || target->right == NULL) { \
+			*link = target->left != NULL ? target->left : target->right; \
+			d--; \
+		} else { \
+			/* Replace with the largest node in the left subtree. */ \
+			name##_node *repl = NULL; \
+\
+			d++; \
+			path[d] = &target->left; \
+\
+			while ((*path[d])->right != NULL) { \
+				d++; \
+				assert(d < AVL_MAX_HEIGHT); \
+				path[d] = &(*path[d - 1])->right; \
+			} \
+			repl = *path[d]; \
+			*path[d] = repl->left; \
+			repl->left = target->left; \
+			repl->right = target->right; \
+			repl->height = target->height; \
+			*link = repl; \
+			path[depth + 1] = &repl->left; \
+			d--; \
+		} \
+		name##_retrace(path, d); \
+		tree->size--; \
+\
+		if (value != NULL) { \
+			*value = target->key; \
+		} \
+		free(target); \
+		removed = 1; \
+	} \
+	return removed; \
+} \
+\
+static inline void name##_inorder(const name *tree, key_type *values) { \
+	name##_inorder_aux(tree->root, values, 0); \
+} \
+\
+static inline void name##_preorder(const name *tree, key_type *values) { \
+	name##_preorder_aux(tree->root, values, 0); \
+} \
+\
+static inline void name##_postorder(const name *tree, key_type *values) { \
+	name##_postorder_aux(tree->root, values, 0); \
+} \
+\
+static inline key_type name##_max(const name *tree) { \
+	assert(tree->root != NULL); \
+	const name##_node *node = tree->root; \
+\
+	while (node->right != NULL) { \
+		node = node->right; \
+	} \
+	return node->key; \
+} \
+\
+static inline key_type name##_min(const name *tree) { \
+	assert(tree->root != NULL); \
+	const name##_node *node = tree->root; \
+\
+	while (node->left != NULL) { \
+		node = node->left; \
+	} \
+	return node->key; \
+} \
+\
+static inline void name##_node_counts(const name *tree, int *zero, \
+		int *one, int *two) { \
+	*zero = *one = *two = 0; \
+	name##_node_counts_aux(tree->root, zero, one, two); \
+} \
+\
+static inline int name##_leaf_count(const name *tree) { \
+	int zero, one, two; \
+\
+	name##_node_counts(tree, &zero, &one, &two); \
+	return zero; \
+} \
+\
+static inline int name##_one_child_count(const name *tree) { \
+	int zero, one, two; \
+\
+	name##_node_counts(tree, &zero, &one, &two); \
+	return one; \
+} \
+\
+static inline int name##_two_child_count(const name *tree) { \
+	int zero, one, two; \
+\
+	name##_node_counts(tree, &zero, &one, &two); \
+	return two; \
+} \
+\
+static inline int name##_balanced(const name *tree) { \
+	return name##_balanced_aux(tree->root); \
+} \
+\
+static inline int name##_valid(const name *tree) { \
+	return name##_valid_aux(tree->root, NULL, NULL); \
+} \
+\
+static inline int name##_equals(const name *target, const name *source) { \
+	return target->size == source->size \
+			&& name##_equals_aux(target->root, source->root); \
+}
+
+#endif /* AVL_TYPED_H_ */
@@ -13,13 +13,32 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <assert.h>
+#include <unistd.h>
 
 // Macro for comparing node heights
 #define MAX_HEIGHT(a,b) ((a) > (b) ? a : b)
+// Scapegoat weight balance: a child subtree may hold at most
+// BST_ALPHA_NUM / BST_ALPHA_DEN of its parent's nodes.
+#define BST_ALPHA_NUM 2
+#define BST_ALPHA_DEN 3
+// Size of the output buffer of the print functions
+#define BST_PRINT_SIZE 4096
 
-// local variables
-static char string[DATA_STRING_SIZE];
+/**
+ * Output of a write function on its way to a sink.
+ */
+typedef struct {
+	const bst *tree; ///< Pointer to the BST being written.
+	bst_sink sink; ///< Where each full buffer goes.
+	void *context; ///< Caller state passed to sink.
+	int ok; ///< 0 once the sink has failed.
+	size_t length; ///< Number of bytes waiting in buffer.
+	size_t size; ///< Size of buffer.
+	char *buffer; ///< The caller's buffer for the output.
+} bst_writer;
 
 // local functions
 
@@ -34,40 +53,12 @@ static bst_node* bst_node_initialize(bst *tree, const data *value) {
 	bst_node *node = malloc(sizeof *node);
 	assert(node != NULL);
 
-	node->height = 1;
 	node->left = NULL;
 	node->right = NULL;
 	node->value = tree->copy(value);
 	return node;
 }
 
-/**
- * Helper function to determine the height of node - handles empty node.
- * @param node The node to process.
- * @return The height of the current node.
- */
-static int bst_node_height(const bst_node *node) {
-	int height = 0;
-
-	if (node != NULL) {
-		height = node->height;
-	}
-	return height;
-}
-
-/**
- * Updates the height of a node. Its height is the max of the heights of its
- * child nodes, plus 1.
- * @param node The node to process.
- */
-static void bst_update_height(bst_node *node) {
-	int left_height = bst_node_height(node->left);
-	int right_height = bst_node_height(node->right);
-
-	node->height = MAX_HEIGHT(left_height, right_height) + 1;
-	return;
-}
-
 /**
  * Destroys a node and its children.
  * @param tree Pointer to a BST.
@@ -117,9 +108,150 @@ static int bst_insert_aux(bst *tree, bst_node **node, const data *value) {
 			inserted = 0;
 		}
 	}
-	if (inserted) {
-		// Update the node height if any of its children have been changed.
-		bst_update_height(*node);
+	return inserted;
+}
+
+/**
+ * Returns the number of nodes in a subtree.
+ * @param node The node to process.
+ * @return The number of nodes in node and its children.
+ */
+static int bst_size_aux(const bst_node *node) {
+	int size = 0;
+
+	if (node != NULL) {
+		size = 1 + bst_size_aux(node->left) + bst_size_aux(node->right);
+	}
+	return size;
+}
+
+/**
+ * Copies the nodes of a subtree into an array in order.
+ * @param node The node to process.
+ * @param nodes Array the nodes are stored in.
+ * @param count Number of nodes stored so far, updated.
+ */
+static void bst_flatten_aux(bst_node *node, bst_node *nodes[], int *count) {
+
+	if (node != NULL) {
+		bst_flatten_aux(node->left, nodes, count);
+		nodes[(*count)++] = node;
+		bst_flatten_aux(node->right, nodes, count);
+	}
+	return;
+}
+
+/**
+ * Links a range of ordered nodes into a perfectly balanced subtree.
+ * @param nodes Array of nodes in order.
+ * @param lo Index of the first node of the range.
+ * @param hi Index past the last node of the range.
+ * @return Pointer to the root of the subtree.
+ */
+static bst_node* bst_build_aux(bst_node *nodes[], int lo, int hi) {
+	bst_node *node = NULL;
+
+	if (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		node = nodes[mid];
+		node->left = bst_build_aux(nodes, lo, mid);
+		node->right = bst_build_aux(nodes, mid + 1, hi);
+	}
+	return node;
+}
+
+/**
+ * Rebuilds a subtree into a perfectly balanced one, reusing its nodes.
+ * @param node Root of the subtree.
+ * @param size Number of nodes in the subtree.
+ * @return Pointer to the root of the rebuilt subtree.
+ */
+static bst_node* bst_rebuild(bst_node *node, int size) {
+
+	if (size > 1) {
+		bst_node **nodes = malloc(size * sizeof *nodes);
+		assert(nodes != NULL);
+		int count = 0;
+
+		bst_flatten_aux(node, nodes, &count);
+		node = bst_build_aux(nodes, 0, count);
+		free(nodes);
+	}
+	return node;
+}
+
+/**
+ * Returns the deepest a node may be in a scapegoat tree of count nodes:
+ * the largest depth d with (BST_ALPHA_DEN / BST_ALPHA_NUM)^d <= count.
+ * @param count Number of nodes in the tree.
+ * @return The depth allowed.
+ */
+static int bst_depth_limit(int count) {
+	double size = (double) BST_ALPHA_DEN / BST_ALPHA_NUM;
+	int depth = 0;
+
+	while (size <= count) {
+		size = size * BST_ALPHA_DEN / BST_ALPHA_NUM;
+		depth++;
+	}
+	return depth;
+}
+
+/**
+ * Inserts value into a scapegoat tree. If the new node is too deep, the
+ * subtree of the lowest ancestor that is out of weight balance is rebuilt
+ * on the way back up.
+ * @param tree Pointer to a BST.
+ * @param node Pointer to the node to process.
+ * @param value The value to insert.
+ * @param depth Depth of node, 0 at the root.
+ * @param size Set to the number of nodes in node's subtree while a
+ * scapegoat is still wanted above node, 0 otherwise.
+ * @return 1 if the value is inserted, 0 otherwise.
+ */
+static int bst_scapegoat_insert_aux(bst *tree, bst_node **node,
+		const data *value, int depth, int *size) {
+	int inserted = 0;
+
+	if (*node == NULL) {
+		// Base case: add a new node containing the value.
+		*node = bst_node_initialize(tree, value);
+		tree->count += 1;
+		inserted = 1;
+		*size = depth > bst_depth_limit(tree->count) ? 1 : 0;
+	} else {
+		// Compare the node data against the new value.
+		int comp = tree->compare((*node)->value, value);
+		const bst_node *sibling = NULL;
+
+		if (comp < 0) {
+			// General case: check the left subtree.
+			inserted = bst_scapegoat_insert_aux(tree, &(*node)->left, value,
+					depth + 1, size);
+			sibling = (*node)->right;
+		} else if (comp > 0) {
+			// General case: check the right subtree.
+			inserted = bst_scapegoat_insert_aux(tree, &(*node)->right, value,
+					depth + 1, size);
+			sibling = (*node)->left;
+		} else {
+			// Base case: value is already in the BST.
+			inserted = 0;
+			*size = 0;
+		}
+		if (*size > 0) {
+			// Weigh the subtree the new node went into against this one.
+			int total = *size + bst_size_aux(sibling) + 1;
+
+			if (*size * BST_ALPHA_DEN > total * BST_ALPHA_NUM) {
+				// This node is the scapegoat.
+				*node = bst_rebuild(*node, total);
+				*size = 0;
+			} else {
+				*size = total;
+			}
+		}
 	}
 	return inserted;
 }
@@ -143,8 +275,6 @@ static bst_node* bst_delete_node(bst_node *parent) {
 		// Continue search for node with largest value
 		repl_node = bst_delete_node(child);
 	}
-	// Recursively update all parent node heights
-	bst_update_height(parent);
 	return repl_node;
 }
 
@@ -172,7 +302,9 @@ static data* bst_remove_aux(bst *tree, bst_node **node, const data *key) {
 			value = bst_remove_aux(tree, &((*node)->right), key);
 		} else {
 			// Value has been found.
-			value = (*node)->value;
+			bst_node *target = *node;
+
+			value = target->value;
 			tree->count--;
 			// Replace this node with another node.
 			if ((*node)->left == NULL && (*node)->right == NULL) {
@@ -202,55 +334,273 @@ static data* bst_remove_aux(bst *tree, bst_node **node, const data *key) {
 				// Replace the removed node.
 				*node = repl_node;
 			}
+			free(target);
 		}
 	}
-	if (*node != NULL && value != NULL) {
-		// If the value was found, update the ancestor heights.
-		bst_update_height(*node);
-	}
 	return value;
 }
 
 /**
- * Prints the contents of the BST in inorder.
+ * Splays the node matching key, or the last node on the path to where key
+ * belongs, to the root of a subtree, top-down. The nodes passed on the way
+ * down are gathered into a tree of nodes before key and a tree of nodes
+ * after it, which become the new root's subtrees. There is no recursion
+ * and there are no parent links.
  * @param tree Pointer to a BST.
- * @param node The node to process.
+ * @param node Root of a non-empty subtree.
+ * @param key The key to look for.
+ * @param comp Set to the comparison of the new root's value with key.
+ * @return the new root of the subtree.
+ */
+static bst_node* bst_splay(const bst *tree, bst_node *node, const data *key,
+		int *comp) {
+	// The header's right link holds the before tree, its left the after tree.
+	bst_node header = { NULL, NULL, NULL };
+	bst_node *before = &header;
+	bst_node *after = &header;
+	int current = tree->compare(node->value, key);
+	int done = 0;
+
+	while (!done) {
+
+		if (current < 0 && node->left != NULL) {
+			bst_node *child = node->left;
+			int next = tree->compare(child->value, key);
+
+			if (next < 0 && child->left != NULL) {
+				// Zig-zig: rotate the child up before moving on.
+				node->left = child->right;
+				child->right = node;
+				node = child;
+				child = node->left;
+				next = tree->compare(child->value, key);
+			}
+			// node comes after key: hang it below the after tree.
+			after->left = node;
+			after = node;
+			node = child;
+			current = next;
+		} else if (current > 0 && node->right != NULL) {
+			bst_node *child = node->right;
+			int next = tree->compare(child->value, key);
+
+			if (next > 0 && child->right != NULL) {
+				// Zig-zig: rotate the child up before moving on.
+				node->right = child->left;
+				child->left = node;
+				node = child;
+				child = node->right;
+				next = tree->compare(child->value, key);
+			}
+			// node comes before key: hang it below the before tree.
+			before->right = node;
+			before = node;
+			node = child;
+			current = next;
+		} else {
+			done = 1;
+		}
+	}
+	// The new root's subtrees go at the bottom of the two trees.
+	before->right = node->left;
+	after->left = node->right;
+	node->left = header.right;
+	node->right = header.left;
+	*comp = current;
+	return node;
+}
+
+/**
+ * Inserts value into a splay tree and splays it to the root.
+ * @param tree Pointer to a BST.
+ * @param value The value to insert.
+ * @return 1 if the value is inserted, 0 otherwise.
  */
-static void bst_inorder_aux(const bst *tree, const bst_node *node) {
+static int bst_splay_insert(bst *tree, const data *value) {
+	int comp = 1;
 
-	if (node != NULL) {
-		bst_inorder_aux(tree, node->left);
-		printf("%s\n", tree->to_string(string, DATA_STRING_SIZE, node->value));
-		bst_inorder_aux(tree, node->right);
+	if (tree->root != NULL) {
+		tree->root = bst_splay(tree, tree->root, value, &comp);
 	}
-	return;
+	if (comp != 0) {
+		// The new node takes the place of the root, which comes down on the
+		// side of value it belongs.
+		bst_node *node = bst_node_initialize(tree, value);
+		bst_node *root = tree->root;
+
+		if (root != NULL && comp < 0) {
+			node->left = root->left;
+			root->left = NULL;
+			node->right = root;
+		} else if (root != NULL) {
+			node->right = root->right;
+			root->right = NULL;
+			node->left = root;
+		}
+		tree->root = node;
+		tree->count++;
+	}
+	return comp != 0;
 }
 
 /**
- * Prints the contents of the tree in preorder.
+ * Removes the value matching key from a splay tree. The node found is
+ * splayed to the root and replaced by the largest node of its left
+ * subtree, splayed to the top of that subtree.
  * @param tree Pointer to a BST.
+ * @param key The key to look for.
+ * @return data if the key is found and the value removed, NULL otherwise.
+ */
+static data* bst_splay_remove(bst *tree, const data *key) {
+	data *value = NULL;
+	int comp = 0;
+
+	if (tree->root != NULL) {
+		tree->root = bst_splay(tree, tree->root, key, &comp);
+
+		if (comp == 0) {
+			bst_node *node = tree->root;
+
+			value = node->value;
+
+			if (node->left == NULL) {
+				tree->root = node->right;
+			} else {
+				// key is after every value on the left, so the largest of
+				// them comes up with no right child.
+				tree->root = bst_splay(tree, node->left, key, &comp);
+				tree->root->right = node->right;
+			}
+			free(node);
+			tree->count--;
+		}
+	}
+	return value;
+}
+
+/**
+ * Finds the inorder predecessor of a node with a left child: the rightmost
+ * node of its left subtree, or the node whose thread already leads back.
  * @param node The node to process.
+ * @return The predecessor of node.
  */
-static void bst_preorder_aux(const bst *tree, const bst_node *node) {
+static bst_node* bst_predecessor(const bst_node *node) {
+	bst_node *pred = node->left;
 
-	if (node != NULL) {
-		printf("%s\n", tree->to_string(string, DATA_STRING_SIZE, node->value));
-		bst_preorder_aux(tree, node->left);
-		bst_preorder_aux(tree, node->right);
+	while (pred->right != NULL && pred->right != node) {
+		pred = pred->right;
+	}
+	return pred;
+}
+
+/**
+ * Removes the threads left behind by a Morris traversal that stopped
+ * early. Every remaining thread is reached by following right links from
+ * the node the traversal would have gone to next.
+ * @param node The next node of the stopped traversal.
+ */
+static void bst_unthread(bst_node *node) {
+
+	while (node != NULL) {
+
+		if (node->left != NULL) {
+			bst_node *pred = bst_predecessor(node);
+
+			if (pred->right == node) {
+				pred->right = NULL;
+			}
+		}
+		node = node->right;
 	}
 	return;
 }
 
-static void bst_postorder_aux(const bst *tree, const bst_node *node) {
+/**
+ * Reverses the right links of a chain of nodes.
+ * @param from The first node of the chain.
+ * @param to The last node of the chain.
+ */
+static void bst_reverse_chain(bst_node *from, bst_node *to) {
+	bst_node *x = from;
+	bst_node *y = from->right;
 
-	if (node != NULL) {
-		bst_postorder_aux(tree, node->left);
-		bst_postorder_aux(tree, node->right);
-		printf("%s\n", tree->to_string(string, DATA_STRING_SIZE, node->value));
+	while (x != to) {
+		bst_node *z = y->right;
+
+		y->right = x;
+		x = y;
+		y = z;
 	}
 	return;
 }
 
+/**
+ * Passes the output waiting in a writer's buffer to its sink.
+ * @param writer Pointer to a writer.
+ */
+static void bst_writer_flush(bst_writer *writer) {
+
+	if (writer->ok && writer->length > 0) {
+		writer->ok = writer->sink(writer->buffer, writer->length,
+				writer->context);
+	}
+	writer->length = 0;
+	return;
+}
+
+/**
+ * Formats a value on its own line, straight into a writer's buffer.
+ * (bst_visitor for the write traversals.)
+ * @param value The value to write.
+ * @param context Pointer to a writer.
+ * @return 1 to continue the traversal, 0 once the sink has failed.
+ */
+static int bst_write_visit(const data *value, void *context) {
+	bst_writer *writer = context;
+
+	if (writer->size - writer->length < BST_WRITE_MIN) {
+		// Not enough room left for a whole line.
+		bst_writer_flush(writer);
+	}
+	if (writer->ok) {
+		char *line = writer->buffer + writer->length;
+		const char *string = writer->tree->to_string(line, DATA_STRING_SIZE,
+				value);
+		size_t length = strlen(string);
+
+		assert(length < DATA_STRING_SIZE);
+
+		if (string != line) {
+			// The string was not formatted in place: copy it in.
+			memcpy(line, string, length);
+		}
+		writer->length += length;
+		writer->buffer[writer->length++] = '\n';
+	}
+	return writer->ok;
+}
+
+/**
+ * Writes the values of a tree to a sink in the order of a traversal.
+ * @param tree Pointer to a BST.
+ * @param traverse The traversal, one of the bst_foreach functions.
+ * @param buffer Space for the output on its way to sink.
+ * @param size Size of buffer, at least BST_WRITE_MIN.
+ * @param sink Function the output goes to.
+ * @param context Caller state passed to sink.
+ * @return 1 if all the output was written, 0 if the sink failed.
+ */
+static int bst_write(const bst *tree,
+		int (*traverse)(const bst*, bst_visitor, void*), char *buffer,
+		size_t size, bst_sink sink, void *context) {
+	bst_writer writer = { tree, sink, context, 1, 0, size, buffer };
+	assert(buffer != NULL && size >= BST_WRITE_MIN);
+
+	traverse(tree, bst_write_visit, &writer);
+	bst_writer_flush(&writer);
+	return writer.ok;
+}
+
 /**
  * Returns the number of leaves (nodes with no children) in node.
  * @param node The node to process.
@@ -353,26 +703,25 @@ static void bst_node_counts_aux(bst_node *node, int *zero, int *one, int *two) {
 }
 
 /**
- * Determines whether the BST is balanced.
+ * Computes the height of a subtree, checking its balance on the way.
  * @param node The node to process.
- * @return 1 if the node and its children are balanced, 0 otherwise.
+ * @return height of the subtree, -1 if it is not balanced.
  */
 static int bst_balanced_aux(const bst_node *node) {
-	int balanced = 0;
-
-	if (node == NULL || node->height == 1) {
-		// Base case: no node or a leaf, so no children.
-		balanced = 1;
-	} else if (abs(bst_node_height(node->left) - bst_node_height(node->right))
-			> 1) {
-		// Base case: left or right subtree is too deep.
-		balanced = 0;
-	} else {
-		// General case: check the children of node.
-		balanced = bst_balanced_aux(node->left)
-				&& bst_balanced_aux(node->right);
+	int height = 0;
+
+	if (node != NULL) {
+		int left = bst_balanced_aux(node->left);
+		int right = bst_balanced_aux(node->right);
+
+		if (left < 0 || right < 0 || abs(left - right) > 1) {
+			// Base case: left or right subtree is too deep.
+			height = -1;
+		} else {
+			height = MAX_HEIGHT(left, right) + 1;
+		}
 	}
-	return balanced;
+	return height;
 }
 
 /**
@@ -396,10 +745,6 @@ static int bst_valid_aux(const bst *tree, const bst_node *node,
 			&& tree->compare(max_node->value, node->value) >= 0) {
 		// Base case: node value greater = max_node value
 		valid = 0;
-	} else if (MAX_HEIGHT(bst_node_height(node->left),
-			bst_node_height(node->right)) > (bst_node_height(node) + 1)) {
-		// Base case: node heights are incorrect
-		valid = 0;
 	} else {
 		valid = bst_valid_aux(tree, node->left, min_node, node)
 				&& bst_valid_aux(tree, node->right, node, max_node);
@@ -416,7 +761,9 @@ bst* bst_initialize(data_destroy destroy, data_copy copy,
 	assert(tree != NULL);
 
 	tree->root = NULL;
+	tree->balance = BST_BALANCE_NONE;
 	tree->count = 0;
+	tree->max_count = 0;
 	tree->destroy = destroy;
 	tree->copy = copy;
 	tree->to_string = to_string;
@@ -424,6 +771,13 @@ bst* bst_initialize(data_destroy destroy, data_copy copy,
 	return tree;
 }
 
+void bst_set_balance(bst *tree, bst_balance balance) {
+	assert(tree->root == NULL);
+
+	tree->balance = balance;
+	return;
+}
+
 void bst_destroy(bst **tree) {
 	bst_destroy_aux(*tree, &(*tree)->root);
 	free(*tree);
@@ -444,73 +798,317 @@ int bst_count(const bst *tree) {
 }
 
 void bst_inorder(const bst *tree) {
-	bst_inorder_aux(tree, tree->root);
+	char buffer[BST_PRINT_SIZE];
+
+	bst_write_inorder(tree, buffer, sizeof buffer, bst_sink_file, stdout);
 	printf("\n");
 	return;
 }
 
 void bst_preorder(const bst *tree) {
-	bst_preorder_aux(tree, tree->root);
+	char buffer[BST_PRINT_SIZE];
+
+	bst_write_preorder(tree, buffer, sizeof buffer, bst_sink_file, stdout);
 	printf("\n");
 	return;
 }
 
 void bst_postorder(const bst *tree) {
-	bst_postorder_aux(tree, tree->root);
+	char buffer[BST_PRINT_SIZE];
+
+	bst_write_postorder(tree, buffer, sizeof buffer, bst_sink_file, stdout);
 	printf("\n");
 	return;
 }
 
-int bst_insert(bst *tree, const data *value) {
-	return bst_insert_aux(tree, &(tree->root), value);
+int bst_write_inorder(const bst *tree, char *buffer, size_t size,
+		bst_sink sink, void *context) {
+	return bst_write(tree, bst_foreach_inorder, buffer, size, sink, context);
 }
 
-data* bst_retrieve(const bst *tree, const data *key) {
+int bst_write_preorder(const bst *tree, char *buffer, size_t size,
+		bst_sink sink, void *context) {
+	return bst_write(tree, bst_foreach_preorder, buffer, size, sink, context);
+}
+
+int bst_write_postorder(const bst *tree, char *buffer, size_t size,
+		bst_sink sink, void *context) {
+	return bst_write(tree, bst_foreach_postorder, buffer, size, sink, context);
+}
+
+int bst_sink_file(const char *bytes, size_t size, void *context) {
+	return fwrite(bytes, 1, size, context) == size;
+}
+
+int bst_sink_fd(const char *bytes, size_t size, void *context) {
+	int fd = *(const int*) context;
+	size_t written = 0;
+	int ok = 1;
+
+	while (ok && written < size) {
+		ssize_t count = write(fd, bytes + written, size - written);
+
+		if (count > 0) {
+			written += count;
+		} else {
+			// Retry a write interrupted before it wrote anything.
+			ok = count < 0 && errno == EINTR;
+		}
+	}
+	return ok;
+}
+
+int bst_sink_memory(const char *bytes, size_t size, void *context) {
+	bst_memory *memory = context;
+
+	if (memory->capacity - memory->length < size) {
+		// Grow to at least double, so appends take amortized O(size).
+		size_t capacity = memory->capacity * 2;
+
+		if (capacity < memory->length + size) {
+			capacity = memory->length + size;
+		}
+		memory->bytes = realloc(memory->bytes, capacity);
+		assert(memory->bytes != NULL);
+		memory->capacity = capacity;
+	}
+	memcpy(memory->bytes + memory->length, bytes, size);
+	memory->length += size;
+	return 1;
+}
+
+int bst_foreach_inorder(const bst *tree, bst_visitor visit, void *context) {
 	bst_node *node = tree->root;
-	data *value = NULL;
+	int count = 0;
+	int more = 1;
 
-	while (node != NULL && value == NULL) {
-		int comp = tree->compare(node->value, key);
+	while (more && node != NULL) {
 
-		if (comp < 0) {
-			node = node->left;
-		} else if (comp > 0) {
+		if (node->left == NULL) {
+			count++;
+			more = visit(node->value, context);
+			node = node->right;
+		} else {
+			bst_node *pred = bst_predecessor(node);
+
+			if (pred->right == NULL) {
+				// Thread the predecessor back to node, then go left.
+				pred->right = node;
+				node = node->left;
+			} else {
+				// Back from the left subtree - remove the thread.
+				pred->right = NULL;
+				count++;
+				more = visit(node->value, context);
+				node = node->right;
+			}
+		}
+	}
+	bst_unthread(node);
+	return count;
+}
+
+int bst_foreach_preorder(const bst *tree, bst_visitor visit, void *context) {
+	bst_node *node = tree->root;
+	int count = 0;
+	int more = 1;
+
+	while (more && node != NULL) {
+
+		if (node->left == NULL) {
+			count++;
+			more = visit(node->value, context);
+			node = node->right;
+		} else {
+			bst_node *pred = bst_predecessor(node);
+
+			if (pred->right == NULL) {
+				// Visit node on the way down, then thread back to it.
+				count++;
+				more = visit(node->value, context);
+				pred->right = node;
+				node = node->left;
+			} else {
+				pred->right = NULL;
+				node = node->right;
+			}
+		}
+	}
+	bst_unthread(node);
+	return count;
+}
+
+int bst_foreach_postorder(const bst *tree, bst_visitor visit, void *context) {
+	// A dummy parent puts the whole tree in a left subtree.
+	bst_node dummy = { NULL, tree->root, NULL };
+	bst_node *node = &dummy;
+	int count = 0;
+	int more = 1;
+
+	while (more && node != NULL) {
+
+		if (node->left == NULL) {
 			node = node->right;
 		} else {
-			value = tree->copy(node->value);
+			bst_node *pred = bst_predecessor(node);
+
+			if (pred->right == NULL) {
+				pred->right = node;
+				node = node->left;
+			} else {
+				// Back from the left subtree: visit its right edge bottom-up
+				// by reversing the edge, then restore it.
+				bst_node *edge = pred;
+
+				bst_reverse_chain(node->left, pred);
+
+				while (more && edge != NULL) {
+					count++;
+					more = visit(edge->value, context);
+					edge = edge == node->left ? NULL : edge->right;
+				}
+				bst_reverse_chain(pred, node->left);
+				pred->right = NULL;
+				node = node->right;
+			}
+		}
+	}
+	bst_unthread(node);
+	return count;
+}
+
+int bst_insert(bst *tree, const data *value) {
+	int inserted = 0;
+
+	if (tree->balance == BST_BALANCE_SPLAY) {
+		inserted = bst_splay_insert(tree, value);
+	} else if (tree->balance == BST_BALANCE_SCAPEGOAT) {
+		int size = 0;
+
+		inserted = bst_scapegoat_insert_aux(tree, &(tree->root), value, 0,
+				&size);
+
+		if (tree->count > tree->max_count) {
+			tree->max_count = tree->count;
+		}
+	} else {
+		inserted = bst_insert_aux(tree, &(tree->root), value);
+	}
+	return inserted;
+}
+
+const data* bst_find(const bst *tree, const data *key) {
+	const data *value = NULL;
+
+	if (tree->balance == BST_BALANCE_SPLAY) {
+
+		if (tree->root != NULL) {
+			// Splaying changes the shape of the tree, not its contents.
+			bst *splayed = (bst*) tree;
+			int comp = 0;
+
+			splayed->root = bst_splay(tree, tree->root, key, &comp);
+
+			if (comp == 0) {
+				value = tree->root->value;
+			}
+		}
+	} else {
+		const bst_node *node = tree->root;
+
+		while (node != NULL && value == NULL) {
+			int comp = tree->compare(node->value, key);
+
+			if (comp < 0) {
+				node = node->left;
+			} else if (comp > 0) {
+				node = node->right;
+			} else {
+				value = node->value;
+			}
 		}
 	}
 	return value;
 }
 
+data* bst_retrieve(const bst *tree, const data *key) {
+	const data *found = bst_find(tree, key);
+	data *value = NULL;
+
+	if (found != NULL) {
+		value = tree->copy(found);
+	}
+	return value;
+}
+
+int bst_retrieve_into(const bst *tree, const data *key, data *value) {
+	const data *found = bst_find(tree, key);
+
+	if (found != NULL) {
+		*value = *found;
+	}
+	return found != NULL;
+}
+
 data* bst_remove(bst *tree, const data *key) {
-	return bst_remove_aux(tree, &(tree->root), key);
+	data *value = NULL;
+
+	if (tree->balance == BST_BALANCE_SPLAY) {
+		value = bst_splay_remove(tree, key);
+	} else {
+		value = bst_remove_aux(tree, &(tree->root), key);
+
+		if (tree->balance == BST_BALANCE_SCAPEGOAT
+				&& tree->count * BST_ALPHA_DEN
+						< tree->max_count * BST_ALPHA_NUM) {
+			// Enough of the tree is gone that its depth bound may not hold.
+			tree->root = bst_rebuild(tree->root, tree->count);
+			tree->max_count = tree->count;
+		}
+	}
+	return value;
 }
 
-data* bst_max(const bst *tree) {
-	assert(tree->root != NULL);
+const data* bst_find_max(const bst *tree) {
+	const data *value = NULL;
 
-	// Find the node containing the largest data.
-	// (It is the right-most node.)
-	bst_node *node = tree->root;
+	if (tree->root != NULL) {
+		// Find the node containing the largest data.
+		// (It is the right-most node.)
+		const bst_node *node = tree->root;
 
-	while (node->right != NULL) {
-		node = node->right;
+		while (node->right != NULL) {
+			node = node->right;
+		}
+		value = node->value;
 	}
-	return tree->copy(node->value);
+	return value;
 }
 
-data* bst_min(const bst *tree) {
-	assert(tree->root != NULL);
+const data* bst_find_min(const bst *tree) {
+	const data *value = NULL;
 
-	// Find the node containing the largest data.
-	// (It is the right-most node.)
-	bst_node *node = tree->root;
+	if (tree->root != NULL) {
+		// Find the node containing the smallest data.
+		// (It is the left-most node.)
+		const bst_node *node = tree->root;
 
-	while (node->left != NULL) {
-		node = node->left;
+		while (node->left != NULL) {
+			node = node->left;
+		}
+		value = node->value;
 	}
-	return tree->copy(node->value);
+	return value;
+}
+
+data* bst_max(const bst *tree) {
+	assert(tree->root != NULL);
+	return tree->copy(bst_find_max(tree));
+}
+
+data* bst_min(const bst *tree) {
+	assert(tree->root != NULL);
+	return tree->copy(bst_find_min(tree));
 }
 
 void bst_node_counts(const bst *tree, int *zero, int *one, int *two) {
@@ -531,7 +1129,7 @@ int bst_two_child_count(const bst *tree) {
 }
 
 int bst_balanced(const bst *tree) {
-	return bst_balanced_aux(tree->root);
+	return bst_balanced_aux(tree->root) >= 0;
 }
 
 int bst_valid(const bst *tree) {
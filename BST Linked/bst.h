@@ -16,24 +16,61 @@
 // define and declare the data type
 #include "data.h"
 
+#include <stddef.h>
+
+// Smallest buffer the write functions accept: room for one value and its
+// newline.
+#define BST_WRITE_MIN (DATA_STRING_SIZE + 1)
+
 // Structures
 
+/**
+ * Defines the rules a BST rebalances by, see bst_set_balance.
+ */
+typedef enum {
+	BST_BALANCE_NONE, BST_BALANCE_SPLAY, BST_BALANCE_SCAPEGOAT
+} bst_balance;
+
 typedef struct bst_node {
 	data *value; ///< Data stored in the node.
-	int height; ///< Height of the current node.
 	struct bst_node *left; ///< Pointer to the left child.
 	struct bst_node *right; ///< Pointer to the right child.
 } bst_node;
 
 typedef struct {
 	int count; ///< Number of nodes in the BST.
+	int max_count; ///< Largest count since the whole BST was last rebuilt.
 	bst_node *root; ///< Pointer to the root node of the BST.
+	bst_balance balance; ///< Rebalancing rules, BST_BALANCE_NONE by default.
 	data_destroy destroy; ///< Pointer to data destroy function.
 	data_copy copy; ///< Pointer to data copy function.
 	data_to_string to_string; ///< Pointer to data to string function.
 	data_compare compare; ///< Pointer to data comparison function.
 } bst;
 
+typedef struct {
+	char *bytes; ///< Output written so far, not NUL terminated.
+	size_t length; ///< Number of bytes of output.
+	size_t capacity; ///< Number of bytes allocated for the output.
+} bst_memory;
+
+/**
+ * Called for each value visited by a traversal.
+ * @param value Pointer to the value stored in the tree (not a copy).
+ * @param context Caller state passed through the traversal.
+ * @return 1 to continue the traversal, 0 to stop it.
+ */
+typedef int (*bst_visitor)(const data *value, void *context);
+
+/**
+ * Receives the output of the write functions, a buffer at a time.
+ * @param bytes The bytes to write.
+ * @param size Number of bytes to write.
+ * @param context Caller state passed to the write function.
+ * @return 1 if all the bytes were written, 0 to stop the output.
+ */
+typedef int (*bst_sink)(const char *bytes, size_t size, void *context);
+
 // Prototypes
 
 /**
@@ -47,6 +84,25 @@ typedef struct {
 bst *bst_initialize(data_destroy destroy, data_copy copy,
 		data_to_string to_string, data_compare compare);
 
+/**
+ * Chooses the rules an empty BST rebalances by. With BST_BALANCE_NONE the
+ * shape of the tree depends only on the order of the inserts. With
+ * BST_BALANCE_SPLAY, bst_insert, bst_remove and the lookups (bst_find,
+ * bst_retrieve and bst_retrieve_into) splay the node they reach to the
+ * root, top-down, without recursion or parent links. Operations take
+ * O(log n) amortized time, and recently used keys are found near the root.
+ * Since lookups then change the shape of the tree, they must not run at
+ * the same time as any other use of it. With BST_BALANCE_SCAPEGOAT, an
+ * insert that lands deeper than log1.5(n) rebuilds the subtree of the
+ * lowest ancestor with a child holding more than 2/3 of its nodes, and a
+ * remove that leaves fewer than 2/3 of max_count nodes rebuilds the whole
+ * tree. The depth stays O(log n), updates take O(log n) amortized time,
+ * and nodes need no balance information.
+ * @param tree Pointer to an empty BST.
+ * @param balance The rebalancing rules to use.
+ */
+void bst_set_balance(bst *tree, bst_balance balance);
+
 /**
  * Deallocates memory for a BST.
  * @param tree A BST handle.
@@ -90,6 +146,26 @@ int bst_insert(bst *tree, const data *value);
  */
 data *bst_retrieve(const bst *tree, const data *key);
 
+/**
+ * Finds the value matching key in a BST without copying it. (Iterative)
+ * The pointer is owned by the tree: it must not be freed, and it is valid
+ * only until the tree is next modified or destroyed.
+ * @param tree Pointer to a BST.
+ * @param key Key value to search for.
+ * @return pointer to the stored data if the key is found, NULL otherwise.
+ */
+const data *bst_find(const bst *tree, const data *key);
+
+/**
+ * Copies the value matching key into caller-owned storage, member-wise
+ * and without allocating memory.
+ * @param tree Pointer to a BST.
+ * @param key Key value to search for.
+ * @param value Storage that receives the value found, if in BST.
+ * @return 1 if the key is found in the BST, 0 otherwise.
+ */
+int bst_retrieve_into(const bst *tree, const data *key, data *value);
+
 /**
  * Removes a node with a value matching key from the bst.
  * @param tree Pointer to a BST.
@@ -116,6 +192,110 @@ void bst_preorder(const bst *tree);
  */
 void bst_postorder(const bst *tree);
 
+/**
+ * Writes the contents of the tree in order, one value per line, to a sink.
+ * Lines are formatted straight into the caller's buffer, and the sink is
+ * only called when it fills up and at the end, so a large buffer reused
+ * across calls makes few sink calls and no allocations. Different trees
+ * can be written by different threads at once, each with its own buffer.
+ * @param tree Pointer to a BST.
+ * @param buffer Space for the output on its way to sink.
+ * @param size Size of buffer, at least BST_WRITE_MIN.
+ * @param sink Function the output goes to, such as bst_sink_file.
+ * @param context Caller state passed to sink.
+ * @return 1 if all the output was written, 0 if the sink failed.
+ */
+int bst_write_inorder(const bst *tree, char *buffer, size_t size,
+		bst_sink sink, void *context);
+
+/**
+ * Writes the contents of the tree in preorder to a sink, as for
+ * bst_write_inorder.
+ * @param tree Pointer to a BST.
+ * @param buffer Space for the output on its way to sink.
+ * @param size Size of buffer, at least BST_WRITE_MIN.
+ * @param sink Function the output goes to, such as bst_sink_file.
+ * @param context Caller state passed to sink.
+ * @return 1 if all the output was written, 0 if the sink failed.
+ */
+int bst_write_preorder(const bst *tree, char *buffer, size_t size,
+		bst_sink sink, void *context);
+
+/**
+ * Writes the contents of the tree in postorder to a sink, as for
+ * bst_write_inorder.
+ * @param tree Pointer to a BST.
+ * @param buffer Space for the output on its way to sink.
+ * @param size Size of buffer, at least BST_WRITE_MIN.
+ * @param sink Function the output goes to, such as bst_sink_file.
+ * @param context Caller state passed to sink.
+ * @return 1 if all the output was written, 0 if the sink failed.
+ */
+int bst_write_postorder(const bst *tree, char *buffer, size_t size,
+		bst_sink sink, void *context);
+
+/**
+ * Writes output to a stream. (bst_sink)
+ * @param bytes The bytes to write.
+ * @param size Number of bytes to write.
+ * @param context The FILE pointer to write to.
+ * @return 1 if all the bytes were written, 0 otherwise.
+ */
+int bst_sink_file(const char *bytes, size_t size, void *context);
+
+/**
+ * Writes output to a file descriptor, retrying partial writes. (bst_sink)
+ * @param bytes The bytes to write.
+ * @param size Number of bytes to write.
+ * @param context Pointer to the int file descriptor to write to.
+ * @return 1 if all the bytes were written, 0 otherwise.
+ */
+int bst_sink_fd(const char *bytes, size_t size, void *context);
+
+/**
+ * Appends output to a growing memory buffer. (bst_sink) Start from a
+ * zeroed bst_memory, and free its bytes when done with them.
+ * @param bytes The bytes to write.
+ * @param size Number of bytes to write.
+ * @param context Pointer to the bst_memory to append to.
+ * @return 1 once the bytes are appended.
+ */
+int bst_sink_memory(const char *bytes, size_t size, void *context);
+
+/**
+ * Calls visit with each value of the tree in order. Uses Morris traversal:
+ * no recursion, no stack and no allocation, however skewed the tree. The
+ * tree is temporarily threaded through unused right links, and restored
+ * before returning, even when visit stops the traversal early. The tree
+ * must not be used by another thread during the traversal.
+ * @param tree Pointer to a BST.
+ * @param visit Function called with each value.
+ * @param context Caller state passed to visit.
+ * @return the number of values visited.
+ */
+int bst_foreach_inorder(const bst *tree, bst_visitor visit, void *context);
+
+/**
+ * Calls visit with each value of the tree in preorder, with Morris
+ * traversal as for bst_foreach_inorder.
+ * @param tree Pointer to a BST.
+ * @param visit Function called with each value.
+ * @param context Caller state passed to visit.
+ * @return the number of values visited.
+ */
+int bst_foreach_preorder(const bst *tree, bst_visitor visit, void *context);
+
+/**
+ * Calls visit with each value of the tree in postorder, with Morris
+ * traversal as for bst_foreach_inorder. Each right edge is reversed in
+ * place while it is visited.
+ * @param tree Pointer to a BST.
+ * @param visit Function called with each value.
+ * @param context Caller state passed to visit.
+ * @return the number of values visited.
+ */
+int bst_foreach_postorder(const bst *tree, bst_visitor visit, void *context);
+
 /**
  * Returns a copy of the maximum value in the tree.
  * @param tree Pointer to a BST.
@@ -130,6 +310,22 @@ data *bst_max(const bst *tree);
  */
 data *bst_min(const bst *tree);
 
+/**
+ * Finds the maximum value in the tree without copying it. The pointer is
+ * valid only until the tree is next modified or destroyed.
+ * @param tree Pointer to a BST.
+ * @return Pointer to the maximum value, NULL if the BST is empty.
+ */
+const data *bst_find_max(const bst *tree);
+
+/**
+ * Finds the minimum value in the tree without copying it. The pointer is
+ * valid only until the tree is next modified or destroyed.
+ * @param tree Pointer to a BST.
+ * @return Pointer to the minimum value, NULL if the BST is empty.
+ */
+const data *bst_find_min(const bst *tree);
+
 /**
  * Finds the number of leaf nodes in a tree.
  * @param tree Pointer to a BST.
@@ -0,0 +1,204 @@
+/*
+ -------------------------------------------------------
+ avl_concurrency_test.c
+ Runs reader threads against writer threads on a concurrent AVL and
+ checks that readers always find the keys no writer touches, that values
+ are never seen half-written, and that the tree is valid afterwards.
+ Build with -fsanitize=thread to check the memory ordering as well.
+ Build:  gcc -O2 -I. -I../AVL data.c ../AVL/avl.c avl_concurrency_test.c
+         -lpthread
+ Usage:  avl_concurrency_test [readers] [writers] [operations] [pool]
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "data.h"
+#include "avl.h"
+
+// Default number of reader threads
+#define TEST_READERS 4
+// Default number of writer threads
+#define TEST_WRITERS 4
+// Default number of operations by each writer
+#define TEST_OPERATIONS 100000
+// Number of distinct keys. Even keys stay in the tree throughout.
+#define TEST_KEYS 20000
+
+// Structures
+
+typedef struct {
+	avl *tree; ///< Tree shared by every thread.
+	unsigned int seed; ///< Seed of the thread's generator.
+	int operations; ///< Number of writes, for writers.
+	atomic_int *stop; ///< Set once the writers are done, for readers.
+	long errors; ///< Number of failed checks.
+} test_thread;
+
+// Local Functions
+
+/**
+ * Returns the next number of a xorshift generator.
+ * @param state Generator state.
+ * @return the next pseudo-random number.
+ */
+static unsigned int test_random(unsigned int *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/**
+ * Merges a record into a stored one by giving it the new value.
+ * @param target The stored record.
+ * @param source The record being upserted.
+ */
+static void test_merge(data *target, const data *source) {
+	target->value = source->value;
+	return;
+}
+
+/**
+ * Inserts, upserts and removes odd keys. Every stored value is the key
+ * negated, so readers can tell a torn value from a whole one.
+ * @param arg Pointer to the thread's test_thread.
+ * @return NULL
+ */
+static void* test_writer(void *arg) {
+	test_thread *thread = arg;
+
+	for (int i = 0; i < thread->operations; i++) {
+		int key = (test_random(&thread->seed) % (TEST_KEYS / 2)) * 2 + 1;
+		data record = { key, -key };
+
+		switch (i % 3) {
+		case 0:
+			avl_insert(thread->tree, &record);
+			break;
+		case 1:
+			avl_upsert(thread->tree, &record, test_merge);
+			break;
+		default: {
+			data *removed = avl_remove(thread->tree, &record);
+
+			if (removed != NULL) {
+				thread->errors += removed->key != key
+						|| removed->value != -key;
+				data_destroy_record(&removed);
+			}
+			break;
+		}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Looks keys up until the writers are done. Even keys must always be
+ * found, and any record found must be whole.
+ * @param arg Pointer to the thread's test_thread.
+ * @return NULL
+ */
+static void* test_reader(void *arg) {
+	test_thread *thread = arg;
+
+	while (!atomic_load(thread->stop)) {
+		int key = test_random(&thread->seed) % TEST_KEYS;
+		data probe = { key, 0 };
+		data found = { 0, 0 };
+		data *copy = NULL;
+
+		if (avl_retrieve_into(thread->tree, &probe, &found)) {
+			thread->errors += found.key != key || found.value != -key;
+		} else {
+			thread->errors += key % 2 == 0;
+		}
+		copy = avl_retrieve(thread->tree, &probe);
+
+		if (copy != NULL) {
+			thread->errors += copy->key != key || copy->value != -key;
+			data_destroy_record(&copy);
+		}
+		copy = avl_min(thread->tree);
+		thread->errors += copy->key != 0;
+		data_destroy_record(&copy);
+	}
+	return NULL;
+}
+
+// Functions
+
+int main(int argc, char *argv[]) {
+	int readers = argc > 1 ? atoi(argv[1]) : TEST_READERS;
+	int writers = argc > 2 ? atoi(argv[2]) : TEST_WRITERS;
+	int operations = argc > 3 ? atoi(argv[3]) : TEST_OPERATIONS;
+	int pool = argc > 4 && atoi(argv[4]) != 0;
+	avl *tree = avl_initialize(data_destroy_record, data_copy_record,
+			data_to_string_record, data_compare_record);
+	test_thread *threads = calloc(readers + writers, sizeof *threads);
+	pthread_t *ids = malloc((readers + writers) * sizeof *ids);
+	atomic_int stop = 0;
+	long errors = 0;
+	int status = 0;
+
+	if (threads == NULL || ids == NULL) {
+		fprintf(stderr, "avl_concurrency_test: out of memory\n");
+		status = 1;
+	} else {
+
+		if (pool) {
+			avl_enable_pool(tree, 1024);
+		}
+		avl_enable_concurrency(tree);
+
+		for (int key = 0; key < TEST_KEYS; key += 2) {
+			data record = { key, -key };
+			avl_insert(tree, &record);
+		}
+		for (int i = 0; i < readers + writers; i++) {
+			threads[i].tree = tree;
+			threads[i].seed = 2463534242u + 7919u * i;
+			threads[i].operations = operations;
+			threads[i].stop = &stop;
+			pthread_create(&ids[i], NULL,
+					i < readers ? test_reader : test_writer, &threads[i]);
+		}
+		for (int i = readers; i < readers + writers; i++) {
+			pthread_join(ids[i], NULL);
+		}
+		atomic_store(&stop, 1);
+
+		for (int i = 0; i < readers; i++) {
+			pthread_join(ids[i], NULL);
+		}
+		for (int i = 0; i < readers + writers; i++) {
+			errors += threads[i].errors;
+		}
+		for (int key = 0; key < TEST_KEYS; key += 2) {
+			data probe = { key, 0 };
+			errors += avl_find(tree, &probe) == NULL;
+		}
+		if (errors != 0 || !avl_valid(tree)) {
+			printf("FAILED: %ld errors, tree %s\n", errors,
+					avl_valid(tree) ? "valid" : "invalid");
+			status = 1;
+		} else {
+			printf("passed: %d readers, %d writers, %d operations each, "
+					"%d values left\n", readers, writers, operations,
+					avl_size(tree));
+		}
+	}
+	free(ids);
+	free(threads);
+	avl_destroy(&tree);
+	return status;
+}
@@ -0,0 +1,104 @@
+/*
+ -------------------------------------------------------
+ avl_load_bench.c
+ Compares restarting an AVL from a file written by avl_save with
+ rebuilding it through avl_insert.
+ Build:  gcc -O2 -I. -I../AVL data.c ../AVL/avl.c avl_load_bench.c -lpthread
+ Usage:  avl_load_bench [count] [file]
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 199309L
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include "data.h"
+#include "avl.h"
+
+// Default number of records
+#define BENCH_COUNT 1000000
+// Default snapshot file name
+#define BENCH_FILE "avl_load_bench.bin"
+
+// Local Functions
+
+/**
+ * Returns the time from a monotonic clock.
+ * @return the time in seconds.
+ */
+static double bench_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the next number of a fixed-seed xorshift generator, so every
+ * run inserts the same keys.
+ * @param state Generator state.
+ * @return the next pseudo-random number.
+ */
+static unsigned int bench_random(unsigned int *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+// Functions
+
+int main(int argc, char *argv[]) {
+	int count = argc > 1 ? atoi(argv[1]) : BENCH_COUNT;
+	const char *path = argc > 2 ? argv[2] : BENCH_FILE;
+	unsigned int state = 2463534242u;
+	avl *tree = avl_initialize(data_destroy_record, data_copy_record,
+			data_to_string_record, data_compare_record);
+	avl *loaded = NULL;
+	double start = 0;
+	double insert_time = 0;
+	double save_time = 0;
+	double load_time = 0;
+
+	// Restart by replaying every record through avl_insert.
+	start = bench_now();
+
+	for (int i = 0; i < count; i++) {
+		data record = { (int) (bench_random(&state) & 0x7fffffff), i };
+		avl_insert(tree, &record);
+	}
+	insert_time = bench_now() - start;
+
+	start = bench_now();
+	int saved = avl_save(tree, path, data_serialize_record);
+	save_time = bench_now() - start;
+	assert(saved);
+	(void) saved;
+
+	// Restart from the saved file.
+	start = bench_now();
+	loaded = avl_load(path, data_destroy_record, data_copy_record,
+			data_to_string_record, data_compare_record,
+			data_deserialize_record);
+	load_time = bench_now() - start;
+	assert(loaded != NULL && avl_size(loaded) == avl_size(tree));
+	assert(avl_valid(loaded));
+
+	printf("records      %d\n", avl_size(tree));
+	printf("insert loop  %.3f s\n", insert_time);
+	printf("avl_save     %.3f s\n", save_time);
+	printf("avl_load     %.3f s (%.1fx faster than the insert loop)\n",
+			load_time, insert_time / load_time);
+
+	avl_destroy(&loaded);
+	avl_destroy(&tree);
+	remove(path);
+	return 0;
+}
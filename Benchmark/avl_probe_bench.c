@@ -0,0 +1,117 @@
+/*
+ -------------------------------------------------------
+ avl_probe_bench.c
+ Compares probing an AVL with many independent keys through
+ avl_retrieve_many with a loop of avl_find calls.
+ Build:  gcc -O2 -I. -I../AVL data.c ../AVL/avl.c avl_probe_bench.c -lpthread
+ Usage:  avl_probe_bench [count] [probes]
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 199309L
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include "data.h"
+#include "avl.h"
+
+// Default number of records
+#define BENCH_COUNT 1000000
+// Default number of probe keys
+#define BENCH_PROBES 1000000
+// Number of times each method is timed - the best time is reported
+#define BENCH_ROUNDS 5
+
+// Local Functions
+
+/**
+ * Returns the time from a monotonic clock.
+ * @return the time in seconds.
+ */
+static double bench_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the next number of a fixed-seed xorshift generator, so every
+ * run uses the same keys.
+ * @param state Generator state.
+ * @return the next pseudo-random number.
+ */
+static unsigned int bench_random(unsigned int *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+// Functions
+
+int main(int argc, char *argv[]) {
+	int count = argc > 1 ? atoi(argv[1]) : BENCH_COUNT;
+	int probes = argc > 2 ? atoi(argv[2]) : BENCH_PROBES;
+	unsigned int state = 2463534242u;
+	avl *tree = avl_initialize(data_destroy_record, data_copy_record,
+			data_to_string_record, data_compare_record);
+	data *keys = malloc(probes * sizeof *keys);
+	const data **found = malloc(probes * sizeof *found);
+	assert(keys != NULL && found != NULL);
+	double scalar_time = 0;
+	double batch_time = 0;
+	int scalar_found = 0;
+	int batch_found = 0;
+
+	// Only even keys are stored, so at least half the probes miss.
+	for (int i = 0; i < count; i++) {
+		data record = { (int) (bench_random(&state) % (2u * count)) & ~1, i };
+		avl_insert(tree, &record);
+	}
+	for (int i = 0; i < probes; i++) {
+		keys[i].key = bench_random(&state) % (2u * count);
+		keys[i].value = 0;
+	}
+	for (int round = 0; round < BENCH_ROUNDS; round++) {
+		double start = bench_now();
+		double time = 0;
+
+		scalar_found = 0;
+
+		for (int i = 0; i < probes; i++) {
+			found[i] = avl_find(tree, &keys[i]);
+			scalar_found += found[i] != NULL;
+		}
+		time = bench_now() - start;
+		scalar_time = round == 0 || time < scalar_time ? time : scalar_time;
+
+		start = bench_now();
+		batch_found = avl_retrieve_many(tree, keys, probes, found);
+		time = bench_now() - start;
+		batch_time = round == 0 || time < batch_time ? time : batch_time;
+	}
+	assert(batch_found == scalar_found);
+
+	for (int i = 0; i < probes; i++) {
+		assert(found[i] == avl_find(tree, &keys[i]));
+	}
+	printf("records            %d\n", avl_size(tree));
+	printf("probes             %d (%d found)\n", probes, batch_found);
+	printf("avl_find loop      %.3f s (%.0f ns/probe)\n", scalar_time,
+			scalar_time * 1e9 / probes);
+	printf("avl_retrieve_many  %.3f s (%.0f ns/probe, %.2fx faster)\n",
+			batch_time, batch_time * 1e9 / probes, scalar_time / batch_time);
+
+	free(found);
+	free(keys);
+	avl_destroy(&tree);
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ -------------------------------------------------------
+ avl_stats_test.c
+ Checks the event counters of avl_stats against the work each kind of
+ insert must do, with and without a node pool: every value stored is
+ allocated and copied exactly once, however it was inserted.
+ Build:  gcc -O2 -DAVL_STATS -I. -I../AVL data.c ../AVL/avl.c
+         avl_stats_test.c -lpthread
+ Usage:  avl_stats_test [count] [threads]
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include "data.h"
+#include "avl.h"
+
+#ifndef AVL_STATS
+#error "avl_stats_test needs the counters: build with -DAVL_STATS"
+#endif
+
+// Default number of values
+#define TEST_COUNT 100000
+// Default number of threads for avl_insert_batch
+#define TEST_THREADS 4
+// Size of a pool chunk, small enough that a run needs many
+#define TEST_CHUNK 256
+
+// Local Functions
+
+/**
+ * Inserts count distinct values into a new tree, half one at a time and
+ * half in one batch with duplicates of the first half, then removes a
+ * quarter, and checks the counters after each step.
+ * @param count Number of distinct values.
+ * @param threads Number of threads for avl_insert_batch.
+ * @param pool Nonzero to give the tree a node pool.
+ * @return the number of failed checks.
+ */
+static int test_counters(int count, int threads, int pool) {
+	avl *tree = avl_initialize(data_destroy_record, data_copy_record,
+			data_to_string_record, data_compare_record);
+	data *batch = malloc(count * sizeof *batch);
+	avl_statistics stats;
+	int half = count / 2;
+	int removed = 0;
+	int errors = 0;
+
+	if (pool) {
+		avl_enable_pool(tree, TEST_CHUNK);
+	}
+	for (int key = 0; key < half; key++) {
+		data record = { key, key };
+		avl_insert(tree, &record);
+	}
+	// The batch repeats the last quarter of the values already there.
+	for (int i = 0; i < count - half / 2; i++) {
+		batch[i].key = half / 2 + i;
+		batch[i].value = 0;
+	}
+	errors += avl_insert_batch(tree, batch, count - half / 2, threads)
+			!= count - half;
+	avl_stats(tree, &stats);
+	errors += stats.counters.allocations != count;
+	errors += stats.counters.copies != count;
+
+	for (int key = 0; key < count; key += 4) {
+		data probe = { key, 0 };
+		data *value = avl_remove(tree, &probe);
+
+		removed += value != NULL;
+		data_destroy_record(&value);
+	}
+	// Nodes freed by the removes are reused, and counted again.
+	for (int key = 0; key < count; key += 4) {
+		data record = { key, key };
+		avl_insert(tree, &record);
+	}
+	avl_stats(tree, &stats);
+	errors += stats.counters.removes != removed;
+	errors += stats.counters.allocations != count + removed;
+	errors += stats.counters.copies != count + removed;
+	errors += avl_size(tree) != count || !avl_valid(tree);
+
+	printf("%s: %s, %ld allocations, %ld copies for %d values\n",
+			errors == 0 ? "passed" : "FAILED", pool ? "pool" : "no pool",
+			stats.counters.allocations, stats.counters.copies, count);
+	free(batch);
+	avl_destroy(&tree);
+	return errors;
+}
+
+// Functions
+
+int main(int argc, char *argv[]) {
+	int count = argc > 1 ? atoi(argv[1]) : TEST_COUNT;
+	int threads = argc > 2 ? atoi(argv[2]) : TEST_THREADS;
+	int errors = 0;
+
+	if (count < 4 || threads < 1) {
+		fprintf(stderr, "usage: %s [count] [threads]\n", argv[0]);
+		errors = 1;
+	} else {
+		errors += test_counters(count, threads, 0);
+		errors += test_counters(count, threads, 1);
+	}
+	return errors != 0;
+}
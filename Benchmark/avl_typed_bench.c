@@ -0,0 +1,212 @@
+/*
+ -------------------------------------------------------
+ avl_typed_bench.c
+ Compares the AVL generated by AVL_DEFINE for int keys with the generic
+ AVL on the same keys, and checks both generated trees, the int one and
+ a string one whose char array key is wrapped in a struct.
+ Build:  gcc -O2 -I. -I../AVL data.c ../AVL/avl.c avl_typed_bench.c
+         -lpthread
+ Usage:  avl_typed_bench [count]
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 199309L
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "data.h"
+#include "avl.h"
+#include "avl_typed.h"
+
+// Default number of keys
+#define BENCH_COUNT 1000000
+// Number of words in the string tree check
+#define BENCH_WORDS 10000
+
+// Structures
+
+typedef struct {
+	char text[16]; ///< NUL-terminated word.
+} word;
+
+// Generated Trees
+
+AVL_DEFINE(int_avl, int, (b > a) - (b < a))
+AVL_DEFINE(word_avl, word, strcmp(b.text, a.text))
+
+// Local Functions
+
+/**
+ * Returns the time from a monotonic clock.
+ * @return the time in seconds.
+ */
+static double bench_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the next number of a fixed-seed xorshift generator, so every
+ * run uses the same keys.
+ * @param state Generator state.
+ * @return the next pseudo-random number.
+ */
+static unsigned int bench_random(unsigned int *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/**
+ * Inserts words into a word_avl, then removes every other one, and checks
+ * the tree and its order after each step.
+ * @param count Number of words.
+ */
+static void bench_check_words(int count) {
+	word_avl *tree = word_avl_initialize();
+	word *values = malloc(count * sizeof *values);
+	assert(values != NULL);
+	word key;
+	int inserted = 0;
+	int removed = 0;
+
+	for (int i = 0; i < count; i++) {
+		snprintf(key.text, sizeof key.text, "w%07d", (i * 7919) % count);
+		inserted += word_avl_insert(tree, key);
+	}
+	inserted += word_avl_insert(tree, key);
+	assert(inserted == count && word_avl_size(tree) == count);
+	assert(word_avl_valid(tree));
+	word_avl_inorder(tree, values);
+
+	for (int i = 1; i < count; i++) {
+		assert(strcmp(values[i - 1].text, values[i].text) < 0);
+	}
+	for (int i = 0; i < count; i += 2) {
+		word value;
+
+		snprintf(key.text, sizeof key.text, "w%07d", i);
+		removed += word_avl_remove(tree, key, &value);
+		assert(strcmp(value.text, key.text) == 0);
+		assert(word_avl_find(tree, key) == NULL);
+	}
+	assert(removed == (count + 1) / 2);
+	assert(word_avl_size(tree) == count - removed);
+	assert(word_avl_valid(tree));
+	snprintf(key.text, sizeof key.text, "w%07d", 1);
+	assert(strcmp(word_avl_min(tree).text, key.text) == 0);
+
+	free(values);
+	word_avl_destroy(&tree);
+	return;
+}
+
+/**
+ * Builds a copy of an int_avl from the keys it was built from, and checks
+ * that it equals the original until one of its keys is removed.
+ * @param tree Pointer to the int_avl.
+ * @param keys The keys inserted into tree, in order.
+ * @param count Number of keys.
+ */
+static void bench_check_equals(const int_avl *tree, const int *keys,
+		int count) {
+	int_avl *copy = int_avl_initialize();
+	int value = 0;
+
+	for (int i = 0; i < count; i++) {
+		int_avl_insert(copy, keys[i]);
+	}
+	assert(int_avl_equals(tree, copy) && int_avl_equals(copy, tree));
+	int_avl_remove(copy, keys[0], &value);
+	assert(!int_avl_equals(tree, copy));
+
+	int_avl_destroy(&copy);
+	return;
+}
+
+// Functions
+
+int main(int argc, char *argv[]) {
+	int count = argc > 1 ? atoi(argv[1]) : BENCH_COUNT;
+	int *keys = malloc(count * sizeof *keys);
+	assert(keys != NULL);
+	unsigned int state = 2463534242u;
+	int_avl *typed = int_avl_initialize();
+	avl *generic = avl_initialize(data_destroy_record, data_copy_record,
+			data_to_string_record, data_compare_record);
+	double typed_insert = 0;
+	double typed_find = 0;
+	double generic_insert = 0;
+	double generic_find = 0;
+	int typed_found = 0;
+	int generic_found = 0;
+	double start = 0;
+
+	for (int i = 0; i < count; i++) {
+		keys[i] = (int) (bench_random(&state) % (2u * count));
+	}
+	start = bench_now();
+
+	for (int i = 0; i < count; i++) {
+		int_avl_insert(typed, keys[i]);
+	}
+	typed_insert = bench_now() - start;
+	start = bench_now();
+
+	for (int i = 0; i < count; i++) {
+		typed_found += int_avl_find(typed, keys[i] ^ 1) != NULL;
+	}
+	typed_find = bench_now() - start;
+	start = bench_now();
+
+	for (int i = 0; i < count; i++) {
+		data record = { keys[i], i };
+		avl_insert(generic, &record);
+	}
+	generic_insert = bench_now() - start;
+	start = bench_now();
+
+	for (int i = 0; i < count; i++) {
+		data record = { keys[i] ^ 1, 0 };
+		generic_found += avl_find(generic, &record) != NULL;
+	}
+	generic_find = bench_now() - start;
+
+	assert(int_avl_valid(typed) && avl_valid(generic));
+	assert(int_avl_size(typed) == avl_size(generic));
+	assert(typed_found == generic_found);
+	// The same inserts into either tree give the same shape.
+	assert(int_avl_leaf_count(typed) == avl_leaf_count(generic));
+	assert(int_avl_one_child_count(typed) == avl_one_child_count(generic));
+	assert(int_avl_two_child_count(typed) == avl_two_child_count(generic));
+	bench_check_equals(typed, keys, count);
+	bench_check_words(BENCH_WORDS);
+
+	printf("keys               %d (%d distinct)\n", count,
+			int_avl_size(typed));
+	printf("int_avl insert     %.3f s (%.0f ns/op)\n", typed_insert,
+			typed_insert * 1e9 / count);
+	printf("avl insert         %.3f s (%.0f ns/op)\n", generic_insert,
+			generic_insert * 1e9 / count);
+	printf("int_avl find       %.3f s (%.0f ns/op)\n", typed_find,
+			typed_find * 1e9 / count);
+	printf("avl find           %.3f s (%.0f ns/op, %.2fx slower)\n",
+			generic_find, generic_find * 1e9 / count,
+			generic_find / typed_find);
+
+	free(keys);
+	int_avl_destroy(&typed);
+	avl_destroy(&generic);
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ -------------------------------------------------------
+ data.c
+ Integer record data type for the benchmarks.
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+#include "data.h"
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Functions
+
+void data_destroy_record(data **source) {
+	free(*source);
+	*source = NULL;
+	return;
+}
+
+data* data_copy_record(const data *source) {
+	data *target = malloc(sizeof *target);
+	assert(target != NULL);
+
+	*target = *source;
+	return target;
+}
+
+char* data_to_string_record(char *string, size_t size, const data *source) {
+	snprintf(string, size, "%d: %d", source->key, source->value);
+	return string;
+}
+
+int data_compare_record(const data *target, const data *source) {
+	return (source->key > target->key) - (source->key < target->key);
+}
+
+size_t data_serialize_record(unsigned char *buffer, size_t size,
+		const data *source) {
+
+	if (size >= sizeof *source) {
+		memcpy(buffer, source, sizeof *source);
+	}
+	return sizeof *source;
+}
+
+data* data_deserialize_record(const unsigned char *buffer, size_t size) {
+	data *target = malloc(sizeof *target);
+	assert(target != NULL && size == sizeof *target);
+
+	memcpy(target, buffer, sizeof *target);
+	return target;
+}
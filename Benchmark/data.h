@@ -0,0 +1,85 @@
+/*
+ -------------------------------------------------------
+ data.h
+ Integer record data type for the benchmarks.
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+#ifndef DATA_H_
+#define DATA_H_
+
+// Includes
+#include <stddef.h>
+
+// Size of the string buffer used by data_to_string
+#define DATA_STRING_SIZE 80
+
+// Structures
+
+typedef struct {
+	int key; ///< Key the records are ordered by.
+	int value; ///< Value stored with the key.
+} data;
+
+typedef void (*data_destroy)(data **source);
+typedef data* (*data_copy)(const data *source);
+typedef char* (*data_to_string)(char *string, size_t size,
+		const data *source);
+typedef int (*data_compare)(const data *target, const data *source);
+
+// Prototypes
+
+/**
+ * Deallocates memory for a record.
+ * @param source Pointer to a record handle.
+ */
+void data_destroy_record(data **source);
+
+/**
+ * Allocates a copy of a record.
+ * @param source Pointer to a record.
+ * @return a pointer to a new record.
+ */
+data* data_copy_record(const data *source);
+
+/**
+ * Formats a record as "key: value".
+ * @param string Buffer for the string.
+ * @param size Size of the buffer.
+ * @param source Pointer to a record.
+ * @return string.
+ */
+char* data_to_string_record(char *string, size_t size, const data *source);
+
+/**
+ * Compares the keys of two records.
+ * @param target Pointer to a record.
+ * @param source Pointer to a record.
+ * @return negative if source comes before target, positive if it comes
+ * after, 0 if the keys are equal.
+ */
+int data_compare_record(const data *target, const data *source);
+
+/**
+ * Writes a record as bytes.
+ * @param buffer Buffer that receives the bytes.
+ * @param size Size of the buffer.
+ * @param source Pointer to a record.
+ * @return the number of bytes in the record.
+ */
+size_t data_serialize_record(unsigned char *buffer, size_t size,
+		const data *source);
+
+/**
+ * Makes a record from the bytes written by data_serialize_record.
+ * @param buffer The bytes of the record.
+ * @param size Number of bytes.
+ * @return a pointer to a new record.
+ */
+data* data_deserialize_record(const unsigned char *buffer, size_t size);
+
+#endif /* DATA_H_ */
@@ -0,0 +1,631 @@
+/*
+ -------------------------------------------------------
+ tree_bench.c
+ Runs the same generated workloads against the AVL, in its strict and
+ weak balance modes, the BST, plain, splayed and scapegoat-balanced, and
+ the Popularity Tree, and reports throughput, latency percentiles,
+ comparisons and AVL rotations per operation and peak memory for each.
+ Build:  gcc -O2 -I. -I../AVL "-I../BST Linked" "-I../Popularity Tree"
+         data.c ../AVL/avl.c "../BST Linked/bst.c"
+         "../Popularity Tree/pt.c" tree_bench.c -lpthread -lm
+         Add -DAVL_STATS to count rotations, which are left empty (null
+         in JSON) without it.
+ Usage:  tree_bench [count] [csv|json]
+ -------------------------------------------------------
+ Author:       Laksitha Dissanayake
+ ID:           170870810
+ Email:        diss0810@wlu.ca
+ Version:      2019-05-27
+ -------------------------------------------------------
+ */
+#define _DEFAULT_SOURCE
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "data.h"
+#include "avl.h"
+#include "bst.h"
+#include "pt.h"
+
+// Default number of keys in each workload. The BST and the PT are not
+// balanced, so the sorted workloads take quadratic time on them.
+#define BENCH_COUNT 20000
+// Seed of every workload, so each run replays the same operations
+#define BENCH_SEED 2463534242u
+// Skew of the Zipfian workload
+#define BENCH_ZIPF_S 0.99
+
+// Structures
+
+typedef enum {
+	BENCH_INSERT, BENCH_FIND, BENCH_REMOVE
+} bench_kind;
+
+typedef struct {
+	bench_kind kind; ///< Operation to perform.
+	int key; ///< Key the operation is given.
+} bench_op;
+
+/**
+ * The operations of a tree ADT, so one driver can run them all.
+ */
+typedef struct {
+	const char *name; ///< Name reported for the tree.
+	void* (*create)(void); ///< Makes an empty tree.
+	void (*destroy)(void *tree); ///< Destroys a tree.
+	int (*insert)(void *tree, const data *value); ///< Inserts a copy.
+	int (*find)(void *tree, const data *key); ///< Looks up a key.
+	int (*remove)(void *tree, const data *key); ///< NULL if not supported.
+	long (*rotations)(void *tree); ///< Rotations made, NULL if not counted.
+} bench_tree;
+
+typedef struct {
+	const char *name; ///< Name reported for the workload.
+	int (*generate)(bench_op ops[], int n); ///< Fills in the operations.
+} bench_workload;
+
+typedef struct {
+	int ops; ///< Number of operations run.
+	double seconds; ///< Time taken by all the operations.
+	long long p50; ///< Median operation latency in nanoseconds.
+	long long p99; ///< 99th percentile latency in nanoseconds.
+	long long p999; ///< 99.9th percentile latency in nanoseconds.
+	double compares; ///< Comparisons per operation.
+	double rotations; ///< Rotations per operation, negative if not counted.
+	long peak_rss; ///< Peak resident memory in kilobytes.
+} bench_result;
+
+// Comparisons made by the tree under test
+static long compares = 0;
+
+// Local Functions
+
+/**
+ * Returns the time from a monotonic clock.
+ * @return the time in nanoseconds.
+ */
+static long long bench_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Returns the next number of a fixed-seed xorshift generator.
+ * @param state Generator state.
+ * @return the next pseudo-random number.
+ */
+static unsigned int bench_random(unsigned int *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/**
+ * Compares two records, counting the comparison.
+ * @param target Pointer to a record.
+ * @param source Pointer to a record.
+ * @return the result of data_compare_record.
+ */
+static int bench_compare(const data *target, const data *source) {
+	compares++;
+	return data_compare_record(target, source);
+}
+
+// Adapters from each tree ADT to bench_tree. Lookups use retrieve_into so
+// that no tree pays for copying the value found.
+
+static void* bench_avl_create(void) {
+	return avl_initialize(data_destroy_record, data_copy_record,
+			data_to_string_record, bench_compare);
+}
+
+static void* bench_avl_weak_create(void) {
+	avl *tree = bench_avl_create();
+
+	avl_set_balance(tree, AVL_BALANCE_WEAK);
+	return tree;
+}
+
+static void bench_avl_destroy(void *tree) {
+	avl *handle = tree;
+
+	avl_destroy(&handle);
+	return;
+}
+
+static int bench_avl_insert(void *tree, const data *value) {
+	return avl_insert(tree, value);
+}
+
+static int bench_avl_find(void *tree, const data *key) {
+	data value;
+
+	return avl_retrieve_into(tree, key, &value);
+}
+
+static int bench_avl_remove(void *tree, const data *key) {
+	data *value = avl_remove(tree, key);
+	int removed = value != NULL;
+
+	if (removed) {
+		data_destroy_record(&value);
+	}
+	return removed;
+}
+
+static long bench_avl_rotations(void *tree) {
+	long rotations = -1;
+#ifdef AVL_STATS
+	avl_statistics stats;
+
+	avl_stats(tree, &stats);
+	rotations = stats.counters.single_rotations
+			+ stats.counters.double_rotations;
+#else
+	(void) tree;
+#endif
+	return rotations;
+}
+
+static void* bench_bst_create(void) {
+	return bst_initialize(data_destroy_record, data_copy_record,
+			data_to_string_record, bench_compare);
+}
+
+static void* bench_bst_splay_create(void) {
+	bst *tree = bench_bst_create();
+
+	bst_set_balance(tree, BST_BALANCE_SPLAY);
+	return tree;
+}
+
+static void* bench_bst_scapegoat_create(void) {
+	bst *tree = bench_bst_create();
+
+	bst_set_balance(tree, BST_BALANCE_SCAPEGOAT);
+	return tree;
+}
+
+static void bench_bst_destroy(void *tree) {
+	bst *handle = tree;
+
+	bst_destroy(&handle);
+	return;
+}
+
+static int bench_bst_insert(void *tree, const data *value) {
+	return bst_insert(tree, value);
+}
+
+static int bench_bst_find(void *tree, const data *key) {
+	data value;
+
+	return bst_retrieve_into(tree, key, &value);
+}
+
+static int bench_bst_remove(void *tree, const data *key) {
+	data *value = bst_remove(tree, key);
+	int removed = value != NULL;
+
+	if (removed) {
+		data_destroy_record(&value);
+	}
+	return removed;
+}
+
+static void* bench_pt_create(void) {
+	return pt_initialize(data_destroy_record, data_copy_record,
+			data_to_string_record, bench_compare);
+}
+
+static void bench_pt_destroy(void *tree) {
+	pt *handle = tree;
+
+	pt_destroy(&handle);
+	return;
+}
+
+static int bench_pt_insert(void *tree, const data *value) {
+	return pt_insert(tree, value);
+}
+
+static int bench_pt_find(void *tree, const data *key) {
+	data value;
+
+	return pt_retrieve_into(tree, key, &value);
+}
+
+/**
+ * Fills keys with 0 to n - 1 in a fixed random order.
+ * @param keys Array of n keys.
+ * @param n Number of keys.
+ * @param state Generator state.
+ */
+static void bench_shuffle(int keys[], int n, unsigned int *state) {
+
+	for (int i = 0; i < n; i++) {
+		keys[i] = i;
+	}
+	for (int i = n - 1; i > 0; i--) {
+		int j = bench_random(state) % (i + 1);
+		int temp = keys[i];
+
+		keys[i] = keys[j];
+		keys[j] = temp;
+	}
+	return;
+}
+
+/**
+ * Uniform workload: n inserts of random keys, then n lookups of random
+ * keys from the same range, about a third of which miss.
+ * @param ops Array of 2n operations.
+ * @param n Number of keys.
+ * @return the number of operations.
+ */
+static int bench_uniform(bench_op ops[], int n) {
+	unsigned int state = BENCH_SEED;
+
+	for (int i = 0; i < n; i++) {
+		ops[i].kind = BENCH_INSERT;
+		ops[i].key = bench_random(&state) % n;
+	}
+	for (int i = n; i < 2 * n; i++) {
+		ops[i].kind = BENCH_FIND;
+		ops[i].key = bench_random(&state) % n;
+	}
+	return 2 * n;
+}
+
+/**
+ * Zipfian workload: n inserts of distinct keys in random order, then n
+ * lookups in which the key of popularity rank r is picked with
+ * probability proportional to 1 / r^BENCH_ZIPF_S.
+ * @param ops Array of 2n operations.
+ * @param n Number of keys.
+ * @return the number of operations.
+ */
+static int bench_zipfian(bench_op ops[], int n) {
+	unsigned int state = BENCH_SEED;
+	int *keys = malloc(n * sizeof *keys);
+	double *cdf = malloc(n * sizeof *cdf);
+	assert(keys != NULL && cdf != NULL);
+	double total = 0;
+
+	bench_shuffle(keys, n, &state);
+
+	for (int i = 0; i < n; i++) {
+		ops[i].kind = BENCH_INSERT;
+		ops[i].key = keys[i];
+		total += 1 / pow(i + 1, BENCH_ZIPF_S);
+		cdf[i] = total;
+	}
+	for (int i = n; i < 2 * n; i++) {
+		// Find the first rank whose cumulative weight covers the draw.
+		double u = (bench_random(&state) >> 8) / 16777216.0 * total;
+		int lo = 0;
+		int hi = n - 1;
+
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+
+			if (cdf[mid] < u) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		ops[i].kind = BENCH_FIND;
+		ops[i].key = keys[lo];
+	}
+	free(cdf);
+	free(keys);
+	return 2 * n;
+}
+
+/**
+ * Sorted workload: n inserts in ascending key order, then n lookups of
+ * random keys.
+ * @param ops Array of 2n operations.
+ * @param n Number of keys.
+ * @return the number of operations.
+ */
+static int bench_sorted(bench_op ops[], int n) {
+	unsigned int state = BENCH_SEED;
+
+	for (int i = 0; i < n; i++) {
+		ops[i].kind = BENCH_INSERT;
+		ops[i].key = i;
+	}
+	for (int i = n; i < 2 * n; i++) {
+		ops[i].kind = BENCH_FIND;
+		ops[i].key = bench_random(&state) % n;
+	}
+	return 2 * n;
+}
+
+/**
+ * Reverse-sorted workload: n inserts in descending key order, then n
+ * lookups of random keys.
+ * @param ops Array of 2n operations.
+ * @param n Number of keys.
+ * @return the number of operations.
+ */
+static int bench_reverse(bench_op ops[], int n) {
+	int count = bench_sorted(ops, n);
+
+	for (int i = 0; i < n; i++) {
+		ops[i].key = n - 1 - i;
+	}
+	return count;
+}
+
+/**
+ * Mixed workload: n / 2 inserts of random keys, then n operations of
+ * which half are lookups, 30% inserts and 20% removes, all of random keys.
+ * @param ops Array of 2n operations.
+ * @param n Number of keys.
+ * @return the number of operations.
+ */
+static int bench_mixed(bench_op ops[], int n) {
+	unsigned int state = BENCH_SEED;
+	int count = n / 2;
+
+	for (int i = 0; i < count; i++) {
+		ops[i].kind = BENCH_INSERT;
+		ops[i].key = bench_random(&state) % n;
+	}
+	for (int i = 0; i < n; i++) {
+		int pick = bench_random(&state) % 10;
+
+		ops[count].kind = pick < 5 ? BENCH_FIND :
+							pick < 8 ? BENCH_INSERT : BENCH_REMOVE;
+		ops[count].key = bench_random(&state) % n;
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Churn workload: n inserts of distinct keys in random order, then n
+ * operations alternating a remove of a random key with an insert of a
+ * random key, keys drawn from twice the range so that about half of each
+ * hit. The tree stays at about n / 2 keys.
+ * @param ops Array of 2n operations.
+ * @param n Number of keys.
+ * @return the number of operations.
+ */
+static int bench_churn(bench_op ops[], int n) {
+	unsigned int state = BENCH_SEED;
+	int *keys = malloc(n * sizeof *keys);
+	assert(keys != NULL);
+
+	bench_shuffle(keys, n, &state);
+
+	for (int i = 0; i < n; i++) {
+		ops[i].kind = BENCH_INSERT;
+		ops[i].key = keys[i] * 2;
+	}
+	for (int i = n; i < 2 * n; i++) {
+		ops[i].kind = i % 2 == 0 ? BENCH_REMOVE : BENCH_INSERT;
+		ops[i].key = bench_random(&state) % (2 * n);
+	}
+	free(keys);
+	return 2 * n;
+}
+
+/**
+ * Orders latencies for qsort.
+ * @param a Pointer to a latency.
+ * @param b Pointer to a latency.
+ * @return negative, zero or positive as a is less, equal or greater.
+ */
+static int bench_latency_compare(const void *a, const void *b) {
+	long long x = *(const long long*) a;
+	long long y = *(const long long*) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Runs a workload against one tree and measures it.
+ * @param tree The tree ADT.
+ * @param workload The workload.
+ * @param n Number of keys in the workload.
+ * @param result Receives the measurements, apart from peak memory.
+ */
+static void bench_run(const bench_tree *tree, const bench_workload *workload,
+		int n, bench_result *result) {
+	bench_op *ops = malloc(2 * n * sizeof *ops);
+	long long *latency = malloc(2 * n * sizeof *latency);
+	assert(ops != NULL && latency != NULL);
+	int count = workload->generate(ops, n);
+	void *handle = tree->create();
+	long long elapsed = 0;
+	int ran = 0;
+
+	compares = 0;
+
+	for (int i = 0; i < count; i++) {
+		data record = { ops[i].key, i };
+		bench_kind kind = ops[i].kind;
+
+		if (kind != BENCH_REMOVE || tree->remove != NULL) {
+			// Trees without remove skip those operations.
+			long long start = bench_now();
+
+			if (kind == BENCH_INSERT) {
+				tree->insert(handle, &record);
+			} else if (kind == BENCH_FIND) {
+				tree->find(handle, &record);
+			} else {
+				tree->remove(handle, &record);
+			}
+			latency[ran] = bench_now() - start;
+			elapsed += latency[ran];
+			ran++;
+		}
+	}
+	qsort(latency, ran, sizeof *latency, bench_latency_compare);
+	result->ops = ran;
+	result->seconds = elapsed / 1e9;
+	result->p50 = latency[(long long) ran * 500 / 1000];
+	result->p99 = latency[(long long) ran * 990 / 1000];
+	result->p999 = latency[(long long) ran * 999 / 1000];
+	result->compares = (double) compares / ran;
+	result->rotations = tree->rotations == NULL ? -1
+			: (double) tree->rotations(handle) / ran;
+
+	tree->destroy(handle);
+	free(latency);
+	free(ops);
+	return;
+}
+
+/**
+ * Runs a workload against one tree in a child process, so that the peak
+ * memory reported belongs to that run alone.
+ * @param tree The tree ADT.
+ * @param workload The workload.
+ * @param n Number of keys in the workload.
+ * @param result Receives the measurements.
+ * @return 1 if the run completed, 0 otherwise.
+ */
+static int bench_isolate(const bench_tree *tree,
+		const bench_workload *workload, int n, bench_result *result) {
+	int channel[2];
+	int done = 0;
+
+	if (pipe(channel) == 0) {
+		pid_t child = fork();
+
+		if (child == 0) {
+			close(channel[0]);
+			bench_run(tree, workload, n, result);
+			done = write(channel[1], result, sizeof *result)
+					== (ssize_t) sizeof *result;
+			_exit(done ? 0 : 1);
+		}
+		close(channel[1]);
+
+		if (child > 0) {
+			struct rusage usage;
+			int status = 0;
+
+			done = read(channel[0], result, sizeof *result)
+					== (ssize_t) sizeof *result;
+			done = wait4(child, &status, 0, &usage) == child && done
+					&& WIFEXITED(status) && WEXITSTATUS(status) == 0;
+			result->peak_rss = usage.ru_maxrss;
+		}
+		close(channel[0]);
+	}
+	return done;
+}
+
+// Functions
+
+int main(int argc, char *argv[]) {
+	const bench_tree trees[] = {
+		{ "avl", bench_avl_create, bench_avl_destroy, bench_avl_insert,
+				bench_avl_find, bench_avl_remove, bench_avl_rotations },
+		{ "avl-weak", bench_avl_weak_create, bench_avl_destroy,
+				bench_avl_insert, bench_avl_find, bench_avl_remove,
+				bench_avl_rotations },
+		{ "bst", bench_bst_create, bench_bst_destroy, bench_bst_insert,
+				bench_bst_find, bench_bst_remove, NULL },
+		{ "bst-splay", bench_bst_splay_create, bench_bst_destroy,
+				bench_bst_insert, bench_bst_find, bench_bst_remove, NULL },
+		{ "bst-scapegoat", bench_bst_scapegoat_create, bench_bst_destroy,
+				bench_bst_insert, bench_bst_find, bench_bst_remove, NULL },
+		{ "pt", bench_pt_create, bench_pt_destroy, bench_pt_insert,
+				bench_pt_find, NULL, NULL }
+	};
+	const bench_workload workloads[] = {
+		{ "uniform", bench_uniform },
+		{ "zipfian", bench_zipfian },
+		{ "sorted", bench_sorted },
+		{ "reverse", bench_reverse },
+		{ "mixed", bench_mixed },
+		{ "churn", bench_churn }
+	};
+	int tree_count = sizeof trees / sizeof trees[0];
+	int workload_count = sizeof workloads / sizeof workloads[0];
+	int n = argc > 1 ? atoi(argv[1]) : BENCH_COUNT;
+	int json = argc > 2 && strcmp(argv[2], "json") == 0;
+	int first = 1;
+	int failed = 0;
+
+	if (n < 1) {
+		fprintf(stderr, "usage: %s [count] [csv|json]\n", argv[0]);
+		return 2;
+	}
+	if (json) {
+		printf("[\n");
+	} else {
+		printf("tree,workload,count,seed,ops,seconds,ops_per_sec,"
+				"p50_ns,p99_ns,p999_ns,compares_per_op,rotations_per_op,"
+				"peak_rss_kb\n");
+	}
+	for (int w = 0; w < workload_count; w++) {
+
+		for (int t = 0; t < tree_count; t++) {
+			bench_result result;
+			char rotations[32];
+
+			if (!bench_isolate(&trees[t], &workloads[w], n, &result)) {
+				fprintf(stderr, "%s/%s failed\n", trees[t].name,
+						workloads[w].name);
+				failed = 1;
+			} else {
+
+				if (result.rotations < 0) {
+					// Not counted: an empty field, or null in JSON.
+					snprintf(rotations, sizeof rotations, "%s",
+							json ? "null" : "");
+				} else {
+					snprintf(rotations, sizeof rotations, "%.3f",
+							result.rotations);
+				}
+				if (json) {
+					printf("%s  {\"tree\": \"%s\", \"workload\": \"%s\", "
+							"\"count\": %d, \"seed\": %u, \"ops\": %d, "
+							"\"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+							"\"p50_ns\": %lld, \"p99_ns\": %lld, "
+							"\"p999_ns\": %lld, \"compares_per_op\": %.2f, "
+							"\"rotations_per_op\": %s, \"peak_rss_kb\": %ld}",
+							first ? "" : ",\n", trees[t].name,
+							workloads[w].name, n, BENCH_SEED, result.ops,
+							result.seconds, result.ops / result.seconds,
+							result.p50, result.p99, result.p999,
+							result.compares, rotations, result.peak_rss);
+					first = 0;
+				} else {
+					printf("%s,%s,%d,%u,%d,%.6f,%.0f,%lld,%lld,%lld,%.2f,%s,"
+							"%ld\n", trees[t].name, workloads[w].name, n,
+							BENCH_SEED, result.ops, result.seconds,
+							result.ops / result.seconds, result.p50,
+							result.p99, result.p999, result.compares,
+							rotations, result.peak_rss);
+				}
+			}
+			fflush(stdout);
+		}
+	}
+	if (json) {
+		printf("\n]\n");
+	}
+	return failed;
+}
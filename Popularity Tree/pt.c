@@ -178,29 +178,28 @@ static void pt_rebalance(pt_node **node) {
 }
 
 /**
- * Retrieves a key from the tree. Increments the rcount of the node
+ * Finds a key in the tree. Increments the rcount of the node
  * containing key. Rebalances the tree according to the rcount if necessary.
  * @param node The node to search for key.
  * @param key The key value to search for.
- * @param value The value to return.
- * @return 1 if key is found, 0 otherwise.
+ * @return pointer to the stored value if key is found, NULL otherwise.
  */
-static data* pt_retrieve_aux(pt *tree, pt_node **node, const data *key) {
-	data *value = NULL;
+static const data* pt_find_aux(pt *tree, pt_node **node, const data *key) {
+	const data *value = NULL;
 
 	if (*node != NULL) {
 		int comp = tree->compare((*node)->value, key);
 
 		if (comp == 0) {
 			// key found in tree.
-			value = tree->copy((*node)->value);
+			value = (*node)->value;
 			(*node)->rcount++;
 		} else if (comp < 0) {
 			// Search the left subtree.
-			value = pt_retrieve_aux(tree, &(*node)->left, key);
+			value = pt_find_aux(tree, &(*node)->left, key);
 		} else if (comp > 0) {
 			// Search the right subtree.
-			value = pt_retrieve_aux(tree, &(*node)->right, key);
+			value = pt_find_aux(tree, &(*node)->right, key);
 		}
 	}
 	if (value != NULL) {
@@ -293,7 +292,26 @@ int pt_insert(pt *tree, const data *value) {
 }
 
 data* pt_retrieve(pt *tree, const data *key) {
-	return (pt_retrieve_aux(tree, &tree->root, key));
+	const data *found = pt_find_aux(tree, &tree->root, key);
+	data *value = NULL;
+
+	if (found != NULL) {
+		value = tree->copy(found);
+	}
+	return (value);
+}
+
+const data* pt_find(pt *tree, const data *key) {
+	return (pt_find_aux(tree, &tree->root, key));
+}
+
+int pt_retrieve_into(pt *tree, const data *key, data *value) {
+	const data *found = pt_find_aux(tree, &tree->root, key);
+
+	if (found != NULL) {
+		*value = *found;
+	}
+	return (found != NULL);
 }
 
 int pt_valid(const pt *tree) {
@@ -91,6 +91,27 @@ int pt_insert(pt *tree, const data *value);
  */
 data *pt_retrieve(pt *tree, const data *key);
 
+/**
+ * Finds the value matching key in a PT without copying it. Counts as a
+ * retrieval, so the node may move up the tree. Rotations never move
+ * values, so the pointer is valid until the tree is destroyed. The
+ * pointer is owned by the tree and must not be freed.
+ * @param tree Pointer to a PT.
+ * @param key Key value to search for.
+ * @return pointer to the stored data if the key is found, NULL otherwise.
+ */
+const data *pt_find(pt *tree, const data *key);
+
+/**
+ * Copies the value matching key into caller-owned storage, member-wise
+ * and without allocating memory. Counts as a retrieval.
+ * @param tree Pointer to a PT.
+ * @param key Key value to search for.
+ * @param value Storage that receives the value found, if in PT.
+ * @return 1 if the key is found in the PT, 0 otherwise.
+ */
+int pt_retrieve_into(pt *tree, const data *key, data *value);
+
 /**
  * Determines if a Popularity Tree is valid: does it meet the BST properties,
  * and are the retrieval count relationships valid.